@@ -35,12 +35,36 @@ union  rbuf_;
 static inline void
 amd_send_buf_locked(amdeth_drv mdrv, union rbuf_ *hbuf, int hlen, union rbuf_ *dbuf, int dlen);
 
+static inline void
+amd_send_ref_locked(amdeth_drv mdrv, union rbuf_ *hbuf, int hlen, void *data, int dlen);
+
 #define NETDRV_ENQ_BUFFER(pif, pd, dl)										\
 	do {                                                                    \
 		amdeth_drv adrv = (amdeth_drv)(pif)->drv_p;							\
 		amd_send_buf_locked(adrv, 0, 0, (pd), (dl));						\
 	} while (0)
 
+/* Send a header buffer chained to a (shared) payload buffer; both buffers
+ * are consumed. 'hl' must be the size of the UDP headers and 'dl' the
+ * payload length.
+ */
+#define NETDRV_ENQ_BUFFER_CHAIN(pif, ph, hl, pd, dl)						\
+	do {                                                                    \
+		amdeth_drv adrv = (amdeth_drv)(pif)->drv_p;							\
+		amd_send_buf_locked(adrv, (ph), (hl), (pd), (dl));					\
+	} while (0)
+
+/* Send a header buffer followed by 'dl' bytes of arbitrary memory at 'pd';
+ * the header buffer is consumed. The TX status of the header buffer's tag
+ * is reported once the descriptor is reclaimed (only then the memory is
+ * no longer referenced).
+ */
+#define NETDRV_ENQ_BUFFER_REF(pif, ph, hl, pd, dl)							\
+	do {                                                                    \
+		amdeth_drv adrv = (amdeth_drv)(pif)->drv_p;							\
+		amd_send_ref_locked(adrv, (ph), (hl), (pd), (dl));					\
+	} while (0)
+
 static inline void
 NETDRV_READ_ENADDR(struct IpBscIfRec_ *ipbif_p, uint8_t *buf);
 
@@ -101,6 +125,7 @@ NETDRV_DUMPSTATS_(struct IpBscIfRec_ *ipbif_p, FILE *f);
 
 typedef struct amdeth_drv_s_ {
 	AmdEthDev  mp;
+	IpBscIf    ipbif_p;
 	rtems_id   mutex;
 	rbuf_t     *spare;
 	rtems_id   tid;
@@ -109,17 +134,49 @@ typedef struct amdeth_drv_s_ {
 #define DRVLOCK(drv)   mutex_lock((drv)->mutex)
 #define DRVUNLOCK(drv) mutex_unlk((drv)->mutex)
 
+/* Pass a frame (header 'b0' or AMDETH_TX_HEADER_NONE, data 'b1') to the chip
+ * and release whatever was sent previously out of the same descriptor;
+ * 'hbuf' and 'dbuf' (either may be NULL) are the buffers to release if
+ * the frame cannot be sent.
+ * The status of a tagged head buffer is reported when it is released.
+ */
+static inline void
+amd_send_swp_locked(amdeth_drv mdrv, rbuf_t *hbuf, rbuf_t *dbuf, void *b0, void *b1, int l1)
+{
+int     st;
+rbuf_t  *hd;
+
+	DRVLOCK(mdrv);
+		st = amdEthSendPacketSwp( mdrv->mp, b0, &b1, l1 );
+		if ( st ) {
+			if ( hbuf && mdrv->ipbif_p )
+				txstatus_rbuf( mdrv->ipbif_p, hbuf, -EIO );
+			relrbuf(hbuf);
+			relrbuf(dbuf);
+		} else {
+			if ( b1 ) {
+				hd = (rbuf_t*)((char*)b1 - ETHERPADSZ);
+				/* got back the 'head' of mini-chain */
+				if ( mdrv->ipbif_p )
+					txstatus_rbuf( mdrv->ipbif_p, hd, 0 );
+				relrbuf ( hd->buf.next );
+				relrbuf ( hd );
+			}
+		}
+	DRVUNLOCK(mdrv);
+}
+
 static inline void
 amd_send_buf_locked(amdeth_drv mdrv, rbuf_t *hbuf, int hlen, rbuf_t *dbuf, int dlen)
 {
-int   st,  l1;
+int   l1;
 void *b0, *b1;
-rbuf_t    *hd;
 
 	if ( hbuf ) {
 		/* driver assumes UDP header */
 		assert( hlen == sizeof(LanUdpPktRec) );
 		b0 = (void*)&hbuf->pkt + ETHERPADSZ;
+		b1 = (void*)lpkt_udp_hdrs( &dbuf->pkt ).pld;
 		l1 = dlen;
 		/* chain bufs together */
 		hbuf->buf.next = dbuf;
@@ -129,20 +186,17 @@ rbuf_t    *hd;
 		l1 = dlen - ETHERPADSZ;
 	}
 
-	DRVLOCK(mdrv);
-		st = amdEthSendPacketSwp( mdrv->mp, b0, &b1, l1 );
-		if ( st ) {
-			relrbuf(hbuf);
-			relrbuf(dbuf);
-		} else {
-			if ( b1 ) {
-				hd = (rbuf_t*)((char*)b1 - ETHERPADSZ);
-				/* got back the 'head' of mini-chain */
-				relrbuf ( hd->buf.next );
-				relrbuf ( hd );
-			}
-		}
-	DRVUNLOCK(mdrv);
+	amd_send_swp_locked(mdrv, hbuf, dbuf, b0, b1, l1);
+}
+
+static inline void
+amd_send_ref_locked(amdeth_drv mdrv, rbuf_t *hbuf, int hlen, void *data, int dlen)
+{
+	/* driver assumes UDP header */
+	assert( hlen == sizeof(LanUdpPktRec) );
+	/* nothing chained; the data are not ours to release */
+	hbuf->buf.next = 0;
+	amd_send_swp_locked(mdrv, hbuf, 0, (void*)&hbuf->pkt + ETHERPADSZ, data, dlen);
 }
 
 static inline void NETDRV_READ_ENADDR(struct IpBscIfRec_ *ipbif_p, uint8_t *buf)
@@ -248,8 +302,11 @@ amdeth_drv		  mdrv = lanIpBscIfGetDrv(ipbif_p);
 	if ( pri <= 0 )
 		pri = 20;
 
+	mdrv->ipbif_p = ipbif_p;
+
 	if ( !(tid = task_spawn("ipbd", pri, 10000, drvAmdIpBasicTask, ipbif_p)) ) {
 		fprintf(stderr, "Unable to spawn drvAmdIpBasicTask\n");
+		mdrv->ipbif_p = 0;
 		return -1;
 	}
 
@@ -260,7 +317,10 @@ amdeth_drv		  mdrv = lanIpBscIfGetDrv(ipbif_p);
 static void
 cleanup_rbuf(int tx, void *buf, void *closure)
 {
-rbuf_t *buf_aligned = (buf - ETHERPADSZ);
+amdeth_drv mdrv        = closure;
+rbuf_t     *buf_aligned = (buf - ETHERPADSZ);
+	if ( tx && mdrv && mdrv->ipbif_p )
+		txstatus_rbuf(mdrv->ipbif_p, buf_aligned, -ENETDOWN);
 	relrbuf(buf_aligned);
 }
 
@@ -348,7 +408,7 @@ rtems_id   sync;
 
 	sync = task_pseudojoin_prepare( tid );
 
-	amdEthCloseDev(mdrv->mp, cleanup_rbuf, 0);
+	amdEthCloseDev(mdrv->mp, cleanup_rbuf, mdrv);
 
 	task_pseudojoin_wrapup( tid, sync );
 
@@ -21,7 +21,7 @@ struct IpBscIfRec_;
 			int l_ = sizeof((pif)->arpreq) - ETHERPADSZ;					\
 			memcpy(b, &(pif)->arpreq.ll.dst, l_);							\
 			set_tpa((IpArpRec*)(b + ETHERHDRSZ), ipaddr);					\
-			if ( gnr_send_buf_locked(gdrv, b, b, l_) <= 0 )					\
+			if ( gnr_send_buf(gdrv, b, b, l_) <= 0 )						\
 				relrbuf((rbuf_t*)b);										\
 		}																	\
 	} while (0)
@@ -30,7 +30,7 @@ struct IpBscIfRec_;
 	do {} while (0)
 
 static inline int
-gnr_send_buf_locked(gnreth_drv gdrv, void *pbuf, void *data, int len);
+gnr_send_buf(gnreth_drv gdrv, void *pbuf, void *data, int len);
 
 #define NETDRV_ENQ_BUFFER(pif, pbuf, nbytes)								\
 	do {																	\
@@ -38,10 +38,26 @@ gnr_send_buf_locked(gnreth_drv gdrv, void *pbuf, void *data, int len);
 		int   l_ = (nbytes) - ETHERPADSZ;									\
 		gnreth_drv gdrv = (gnreth_drv)(pif)->drv_p;							\
 																			\
-		if ( gnr_send_buf_locked(gdrv, pbuf, b_, l_) <= 0 )					\
+		if ( gnr_send_buf(gdrv, pbuf, b_, l_) <= 0 ) {						\
+			txstatus_rbuf((pif), (rbuf_t*)pbuf, -ENOBUFS);					\
 			relrbuf((rbuf_t*)pbuf);											\
+		}																	\
 	} while (0)
 
+/* Try to send a buffer; in contrast to NETDRV_ENQ_BUFFER() the buffer
+ * is not released if there is no room (return value <= 0).
+ * This enables TX priority queueing in lanIpBasic. Note that packets
+ * only are held back (and sorted by priority) once the descriptor ring
+ * and GNR_TXSUB_PRIO_DEPTH slots of the submission ring are in use.
+ */
+static inline int
+gnr_try_enq_buffer(struct IpBscIfRec_ *pif, void *pbuf, int nbytes);
+
+#define NETDRV_TRY_ENQ_BUFFER gnr_try_enq_buffer
+
+/* TX outcome is reported by cleanup_txbuf()                                  */
+#define NETDRV_TX_STATUS
+
 static inline void
 NETDRV_READ_ENADDR(struct IpBscIfRec_ *pif, uint8_t *buf);
 
@@ -99,6 +115,51 @@ NETDRV_NAME(struct IpBscIfRec_ *pif);
 
 #define KILL_EVENT RTEMS_EVENT_7
 #define IRQ_EVENT  RTEMS_EVENT_0
+#define SUB_EVENT  RTEMS_EVENT_1
+
+/* Ordinary sender threads don't call the low-level 'send_buf' themselves
+ * but post buffers to a (multi-producer, single-consumer) submission ring
+ * which is drained by the TX task.
+ * The stack's and the driver's own tasks (RX and TX tasks, lpWorker,
+ * callouts) must not wait for the (low-priority) TX task; they fill
+ * descriptors directly, holding the driver mutex (see gnr_send_buf()).
+ * Must be a power of two.
+ */
+#ifndef GNR_TXSUB_SIZE
+#define GNR_TXSUB_SIZE	32
+#endif
+#define GNR_TXSUB_MSK	(GNR_TXSUB_SIZE - 1)
+
+#define GNR_TXSUB_BARRIER()	__asm__ __volatile__("":::"memory")
+
+/* Max. number of buffers handed to the low-level driver before
+ * it must notify the chip (if it supports deferring this).
+ */
+#ifndef GNR_TXSUB_BURST
+#define GNR_TXSUB_BURST	8
+#endif
+
+/* How many ticks a (blocking) sender waits for room in the submission
+ * ring before the buffer is dropped.
+ */
+#ifndef GNR_TXSUB_TMO
+#define GNR_TXSUB_TMO	10
+#endif
+
+/* How many slots of the submission ring may be occupied by buffers passed
+ * in from lanIpBasic's TX priority queues (NETDRV_TRY_ENQ_BUFFER). Once
+ * in the ring a buffer can no longer be overtaken by one of a higher
+ * class, i.e., this adds to the descriptor ring's priority inversion.
+ * If zero then these buffers bypass the ring and are handed to the
+ * low-level driver directly (holding the driver mutex).
+ */
+#ifndef GNR_TXSUB_PRIO_DEPTH
+#define GNR_TXSUB_PRIO_DEPTH	2
+#endif
+
+#if GNR_TXSUB_PRIO_DEPTH > GNR_TXSUB_SIZE
+#error "GNR_TXSUB_PRIO_DEPTH must not exceed GNR_TXSUB_SIZE"
+#endif
 
 #ifndef SIOCGIFMEDIA
 /* media_ioctl() aliases '0' to SIOCGIFMEDIA :-) */
@@ -106,9 +167,26 @@ NETDRV_NAME(struct IpBscIfRec_ *pif);
 #endif
 
 
+typedef struct GnrTxSubRec_ {
+	void                 *pbuf;
+	void                 *data;
+	int                  len;
+	volatile int         full;  /* set by producer, cleared by TX task */
+} GnrTxSubRec, *GnrTxSub;
+
 typedef struct gnreth_drv_s_ {
 	IpBscIf              ipbif_p;
 	rtems_id             mutex;
+	rtems_id             txssem;   /* senders wait here if ring is full */
+	volatile unsigned    txswaiters;
+	volatile unsigned    txshead;  /* next slot to reserve (producers)  */
+	volatile unsigned    txstail;  /* next slot to send (TX task)       */
+	unsigned             txsfull;  /* # times producer found ring full  */
+	unsigned             txsblocked;
+	unsigned             txsdropped;
+	unsigned             txshwfull;/* # times descriptor ring was full  */
+	unsigned             txsdbell; /* # deferred bursts flushed         */
+	GnrTxSubRec          txsub[GNR_TXSUB_SIZE];
 	int                  unit; /* zero based */
 	unsigned             flags;
 	rtems_id             rx_tid;
@@ -123,24 +201,233 @@ typedef struct gnreth_drv_s_ {
 
 volatile unsigned drvGnreth_ignore_stopped = 0;
 
+/* Post a buffer to the submission ring. Slots are reserved with
+ * interrupts disabled for a few instructions only, i.e., senders
+ * never contend for the driver mutex nor for each other.
+ * If 'wait' is nonzero and the ring is full then the caller blocks
+ * (up to GNR_TXSUB_TMO ticks) until the TX task frees a slot.
+ * The buffer is only posted if less than 'max' slots are in use.
+ *
+ * RETURNS: 'len' if the buffer was posted, 0 if the ring is full.
+ */
 static inline int
-gnr_send_buf_locked(gnreth_drv gdrv, void *pbuf, void *data, int len)
+gnr_submit_buf(gnreth_drv gdrv, void *pbuf, void *data, int len, int wait, unsigned max)
 {
-int rval;
-	DRVLOCK(gdrv);
+rtems_interrupt_level l;
+rtems_status_code     sc = RTEMS_SUCCESSFUL;
+rtems_interval        deadline = 0, tmo = GNR_TXSUB_TMO;
+int                   blocked  = 0;
+unsigned              idx;
+GnrTxSub              s;
+
+	while ( 1 ) {
+		rtems_interrupt_disable(l);
+		if ( gdrv->txshead - gdrv->txstail < max ) {
+			idx = gdrv->txshead++;
+			rtems_interrupt_enable(l);
+			break;
+		}
+		gdrv->txsfull++;
+		if ( ! wait || (RTEMS_SUCCESSFUL != sc && RTEMS_UNSATISFIED != sc) ) {
+			if ( wait )
+				gdrv->txsdropped++;
+			rtems_interrupt_enable(l);
+			return 0;
+		}
+		gdrv->txswaiters++;
+		rtems_interrupt_enable(l);
+		if ( ! blocked++ ) {
+			gdrv->txsblocked++;
+			deadline = rtems_clock_get_ticks_since_boot() + GNR_TXSUB_TMO;
+		}
+		/* RTEMS_UNSATISFIED means we were flushed, i.e., woken up */
+		sc = rtems_semaphore_obtain( gdrv->txssem, RTEMS_WAIT, tmo );
+		rtems_interrupt_disable(l);
+			gdrv->txswaiters--;
+		rtems_interrupt_enable(l);
+		/* wakeups (a slot may be taken by somebody else) don't restart
+		 * the timeout; only wait for what is left.
+		 */
+		if ( (int32_t)(tmo = deadline - rtems_clock_get_ticks_since_boot()) <= 0 )
+			sc = RTEMS_TIMEOUT;
+	}
+
+	s       = &gdrv->txsub[ idx & GNR_TXSUB_MSK ];
+	s->pbuf = pbuf;
+	s->data = data;
+	s->len  = len;
+	/* slot contents must be written before the TX task sees 'full'
+	 * (uniprocessor; a compiler barrier is enough)
+	 */
+	GNR_TXSUB_BARRIER();
+	s->full = 1;
+
+	rtems_event_send(gdrv->tx_tid, SUB_EVENT);
+	return len;
+}
+
+/* Hand submitted buffers to the low-level driver; caller must hold the
+ * driver mutex.
+ * If the low-level driver supports it then the chip is only notified
+ * once for a burst of buffers ('more' hint; the doorbell is a slow PCI
+ * write on some chips). The burst is always flushed before returning.
+ *
+ * RETURNS: number of slots freed.
+ */
+static int
+gnr_txsub_flush_locked(gnreth_drv gdrv)
+{
+rtems_interrupt_level l;
+GnrTxSub              s;
+int                   n = 0, st;
+unsigned              waiters;
+int                   deferred = 0;
+
+	while ( (s = &gdrv->txsub[ gdrv->txstail & GNR_TXSUB_MSK ])->full ) {
+		GNR_TXSUB_BARRIER();
 		/* For now - never drop.  Sometimes it is useful to switch
 		 * the PHY to 'loopback' mode in which case the link goes
 		 * 'away' but we still want to send.
 		 */
 		if ( (gdrv->flags & IF_FLG_STOPPED) && ! drvGnreth_ignore_stopped ) {
 			/* drop */
-			rval = 0;
-		} else
-		{
-			rval = gdrv->lldrv.send_buf(gdrv->lldrv.dev, pbuf, data, len);
+			if ( gdrv->ipbif_p )
+				txstatus_rbuf(gdrv->ipbif_p, s->pbuf, -ENETDOWN);
+			relrbuf(s->pbuf);
+		} else {
+			if (    gdrv->lldrv.send_buf_more
+			     && deferred < GNR_TXSUB_BURST - 1
+			     && gdrv->txsub[ (gdrv->txstail + 1) & GNR_TXSUB_MSK ].full ) {
+				/* more to follow */
+				if ( (st = gdrv->lldrv.send_buf_more(gdrv->lldrv.dev, s->pbuf, s->data, s->len)) > 0 )
+					deferred++;
+			} else {
+				st = gdrv->lldrv.send_buf(gdrv->lldrv.dev, s->pbuf, s->data, s->len);
+				deferred = 0;
+			}
+			if ( st <= 0 ) {
+				/* descriptor ring full; retry after swiping */
+				gdrv->txshwfull++;
+				break;
+			}
+		}
+		s->full = 0;
+		gdrv->txstail++;
+		n++;
+	}
+
+	/* never leave buffers stranded in the descriptor ring */
+	if ( deferred && gdrv->lldrv.tx_flush ) {
+		gdrv->lldrv.tx_flush(gdrv->lldrv.dev);
+		gdrv->txsdbell++;
+	}
+
+	if ( n ) {
+		rtems_interrupt_disable(l);
+			waiters = gdrv->txswaiters;
+		rtems_interrupt_enable(l);
+		if ( waiters ) {
+			/* the release covers a sender that has not made it into
+			 * rtems_semaphore_obtain() yet.
+			 */
+			rtems_semaphore_flush( gdrv->txssem );
+			rtems_semaphore_release( gdrv->txssem );
+		}
+	}
+	return n;
+}
+
+/* Release buffers still sitting in the submission ring (TX task gone)        */
+static void
+gnr_txsub_purge(gnreth_drv gdrv)
+{
+GnrTxSub s;
+
+	while ( (s = &gdrv->txsub[ gdrv->txstail & GNR_TXSUB_MSK ])->full ) {
+		if ( gdrv->ipbif_p )
+			txstatus_rbuf(gdrv->ipbif_p, s->pbuf, -ENETDOWN);
+		relrbuf(s->pbuf);
+		s->full = 0;
+		gdrv->txstail++;
+	}
+}
+
+/* Is the caller one of the tasks which must never wait for the TX task
+ * (this driver's RX/TX tasks, lpWorker, callouts)?
+ */
+static inline int
+gnr_drv_context(gnreth_drv gdrv)
+{
+rtems_id self;
+
+	rtems_task_ident(RTEMS_SELF, RTEMS_LOCAL, &self);
+	return    self == gdrv->rx_tid
+	       || self == gdrv->tx_tid
+	       || self == workTask
+	       || self == callout_tid;
+}
+
+/* Hand a buffer to the low-level driver right away. Anything still pending
+ * in the submission ring goes first; if the buffer cannot be sent because
+ * the descriptor ring is full then it is posted to the submission ring
+ * (w/o waiting) provided that less than 'max' slots are in use.
+ *
+ * RETURNS: 'len' if the buffer was sent, posted or dropped (interface
+ *          stopped), 0 if there is no room.
+ */
+static int
+gnr_send_direct(gnreth_drv gdrv, void *pbuf, void *data, int len, unsigned max)
+{
+int st;
+
+	DRVLOCK(gdrv);
+		gnr_txsub_flush_locked(gdrv);
+		if ( gdrv->txsub[ gdrv->txstail & GNR_TXSUB_MSK ].full ) {
+			/* descriptor ring full; line up behind pending buffers */
+			st = 0;
+		} else if ( (gdrv->flags & IF_FLG_STOPPED) && ! drvGnreth_ignore_stopped ) {
+			/* drop */
+			if ( gdrv->ipbif_p )
+				txstatus_rbuf(gdrv->ipbif_p, pbuf, -ENETDOWN);
+			relrbuf(pbuf);
+			st = len;
+		} else if ( (st = gdrv->lldrv.send_buf(gdrv->lldrv.dev, pbuf, data, len)) <= 0 ) {
+			gdrv->txshwfull++;
+			st = 0;
 		}
 	DRVUNLOCK(gdrv);
-	return rval;
+
+	if ( 0 == st && max )
+		st = gnr_submit_buf(gdrv, pbuf, data, len, 0, max);
+
+	return st;
+}
+
+/* Send a buffer which is consumed by the driver if the return value is > 0.
+ * Ordinary senders post to the submission ring and may wait for room;
+ * the stack's and driver's own tasks send directly and never block.
+ */
+static inline int
+gnr_send_buf(gnreth_drv gdrv, void *pbuf, void *data, int len)
+{
+	if ( gnr_drv_context(gdrv) )
+		return gnr_send_direct(gdrv, pbuf, data, len, GNR_TXSUB_SIZE);
+	return gnr_submit_buf(gdrv, pbuf, data, len, 1, GNR_TXSUB_SIZE);
+}
+
+static inline int
+gnr_try_enq_buffer(IpBscIf pif, void *pbuf, int nbytes)
+{
+gnreth_drv gdrv = (gnreth_drv)pif->drv_p;
+void       *data = (char*)pbuf + ETHERPADSZ;
+
+	/* Held-back packets are drained after the TX task flushed the ring;
+	 * don't ask for more slots than GNR_TXSUB_PRIO_DEPTH.
+	 */
+	if ( 0 == GNR_TXSUB_PRIO_DEPTH || gnr_drv_context(gdrv) )
+		return gnr_send_direct(gdrv, pbuf, data, nbytes - ETHERPADSZ, GNR_TXSUB_PRIO_DEPTH);
+	/* Dropping while the interface is stopped is done by the TX task */
+	return gnr_submit_buf(gdrv, pbuf, data, nbytes - ETHERPADSZ, 0, GNR_TXSUB_PRIO_DEPTH);
 }
 
 static inline void NETDRV_READ_ENADDR(IpBscIf pif, uint8_t *buf)
@@ -170,8 +457,12 @@ gnreth_drv drvhdl = (gnreth_drv)pif->drv_p;
 static void
 cleanup_txbuf(void *buf, void *closure, int error_on_tx_occurred)
 {
+gnreth_drv gdrv = closure;
 	/* tx starts at offset 2 -- align back to get buffer address */
-	relrbuf((void*)((uint32_t)buf & ~3));
+	buf = (void*)((uint32_t)buf & ~3);
+	if ( gdrv->ipbif_p )
+		txstatus_rbuf(gdrv->ipbif_p, buf, error_on_tx_occurred ? -EIO : 0);
+	relrbuf(buf);
 }
 
 static void *
@@ -233,6 +524,7 @@ gnreth_drv gdrv = closure;
 static void
 gdrv_cleanup(gnreth_drv gdrv)
 {
+	gnr_txsub_purge(gdrv);
 	if ( gdrv->lldrv.dev ) {
 		gdrv->lldrv.detach(gdrv->lldrv.dev);
 		gdrv->lldrv.dev = 0;
@@ -241,6 +533,10 @@ gdrv_cleanup(gnreth_drv gdrv)
 		rtems_semaphore_delete(gdrv->mutex);
 		gdrv->mutex = 0;
 	}
+	if ( gdrv->txssem ) {
+		rtems_semaphore_delete(gdrv->txssem);
+		gdrv->txssem = 0;
+	}
 	if ( gdrv->rx_tid ) {
 		rtems_task_delete(gdrv->rx_tid);
 		gdrv->rx_tid = 0;
@@ -283,7 +579,13 @@ uint32_t              irq_msk;
 
 	/* Create driver mutex */
 	if ( ! (gdrv->mutex = bsem_create("ipbd", SEM_MUTX)) ) {
-		fprintf(stderr, "drvGnrethIpBasic: unable to create driver mutex");
+		fprintf(stderr, "drvGnrethIpBasic: unable to create driver mutex\n");
+		goto egress;
+	}
+
+	/* Create semaphore for senders waiting on the submission ring */
+	if ( ! (gdrv->txssem = bsem_create("ipbs", SEM_SYNC)) ) {
+		fprintf(stderr, "drvGnrethIpBasic: unable to create TX submission semaphore\n");
 		goto egress;
 	}
 
@@ -426,7 +728,7 @@ IpBscIf               ipbif_p = (IpBscIf)arg;
 gnreth_drv            gdrv    = lanIpBscIfGetDrv(ipbif_p);
 LLDev                 lldev   = gdrv->lldrv.dev;
 LLDrv                 lldrv   = &gdrv->lldrv;
-rtems_event_set       ev_mask = IRQ_EVENT | KILL_EVENT;
+rtems_event_set       ev_mask = IRQ_EVENT | SUB_EVENT | KILL_EVENT;
 rtems_event_set       evs;
 uint32_t              irqs, my_irqs;
 int                   media;
@@ -453,16 +755,34 @@ int                   media;
      */
 	lldrv->enb_irqs(lldev, my_irqs);
 
+	/* Buffers may have been submitted before we started (and the
+	 * SUB_EVENT was cleared by rtems_task_start())
+	 */
+	evs = SUB_EVENT;
+
 	do {
+		if ( (evs & SUB_EVENT) ) {
+		DRVLOCK(gdrv);
+			gnr_txsub_flush_locked(gdrv);
+		DRVUNLOCK(gdrv);
+		}
+
 		rtems_event_receive( ev_mask, RTEMS_WAIT | RTEMS_EVENT_ANY, RTEMS_NO_TIMEOUT, &evs);
 
+		if ( ! (evs & IRQ_EVENT) )
+			continue;
+
 		irqs = lldrv->ack_irqs(lldev, my_irqs);
 
 		if ( (irqs & lldrv->tx_irq_msk) ) {
 		DRVLOCK(gdrv);
 			/* cleanup_txbuf */
 			lldrv->swipe_tx(lldev);
+			/* earlier submissions go first */
+			gnr_txsub_flush_locked(gdrv);
 		DRVUNLOCK(gdrv);
+			/* pass held-back packets on to the freed descriptors */
+			txprio_drain(ipbif_p);
 		}
 		if ( (irqs & lldrv->ln_irq_msk) ) {
 			/* propagate link change to serial port */
@@ -473,7 +793,9 @@ int                   media;
 			} else {
 				gdrv->flags |=  IF_FLG_STOPPED;
 			}
+			gnr_txsub_flush_locked(gdrv);
 		DRVUNLOCK(gdrv);
+			txprio_drain(ipbif_p);
 		}
 		lldrv->enb_irqs(lldev, my_irqs);
 	} while ( ! (evs & KILL_EVENT) );
@@ -571,6 +893,11 @@ static inline void
 NETDRV_DUMPSTATS_(struct IpBscIfRec_ *pif, FILE *f)
 {
 	gnreth_drv gdrv = (gnreth_drv)(pif)->drv_p;
+	fprintf(f, "TX submission ring: %u slots, %u pending\n",
+		GNR_TXSUB_SIZE, gdrv->txshead - gdrv->txstail);
+	fprintf(f, "  ring full: %u (blocked: %u, dropped: %u), descriptors full: %u\n",
+		gdrv->txsfull, gdrv->txsblocked, gdrv->txsdropped, gdrv->txshwfull);
+	fprintf(f, "  bursts flushed: %u\n", gdrv->txsdbell);
 	if ( (gdrv)->lldrv.dump_stats )
 		(gdrv)->lldrv.dump_stats( (gdrv)->lldrv.dev, (f) );
 }
@@ -732,6 +732,8 @@ typedef struct DrvLan9118_ts_ {
 	void				*rx_cb_arg_p;
 	DrvLan9118CB_tpf	tx_cb_pf;
 	void				*tx_cb_arg_p;
+	DrvLan9118CB_tpf	txa_cb_pf;
+	void				*txa_cb_arg_p;
 	DrvLan9118CB_tpf	err_cb_pf;
 	void				*err_cb_arg_p;
 	DrvLan9118CB_tpf	phy_cb_pf;
@@ -750,6 +752,7 @@ typedef struct DrvLan9118_ts_ {
 		uint32_t	rxdf;
 		uint32_t	rsff;
 		uint32_t	tsff;
+		uint32_t	tdfa;
 		uint32_t	filf;
 		uint32_t	lerr;
 		uint32_t	mii;
@@ -1425,6 +1428,8 @@ struct timespec   tv;
 		plan_ps->rx_cb_arg_p	= 0;
 		plan_ps->tx_cb_pf		= 0;
 		plan_ps->tx_cb_arg_p	= 0;
+		plan_ps->txa_cb_pf		= 0;
+		plan_ps->txa_cb_arg_p	= 0;
 		plan_ps->err_cb_pf		= 0;
 		plan_ps->err_cb_arg_p	= 0;
 		plan_ps->phy_cb_pf		= 0;
@@ -1598,6 +1603,8 @@ rtems_status_code sc;
 	plan_ps->rx_cb_arg_p	= 0;
 	plan_ps->tx_cb_pf		= 0;
 	plan_ps->tx_cb_arg_p	= 0;
+	plan_ps->txa_cb_pf		= 0;
+	plan_ps->txa_cb_arg_p	= 0;
 	plan_ps->err_cb_pf 		= 0;
 	plan_ps->err_cb_arg_p	= 0;
 	plan_ps->phy_cb_pf 		= 0;
@@ -1640,6 +1647,7 @@ uint8_t ena[6];
 	fprintf(f_p,"  TX data fifo underflow: %lu\n", plan_ps->stats_s.tdfu);
 	fprintf(f_p,"  TX data fifo overflow : %lu\n", plan_ps->stats_s.tdfo);
 	fprintf(f_p,"  TX stat fifo overflow : %lu\n", plan_ps->stats_s.tsff);
+	fprintf(f_p,"  TX fifo space wakeups : %lu\n", plan_ps->stats_s.tdfa);
 	fprintf(f_p,"  MII errors      : %lu\n", plan_ps->stats_s.mii);
 	return 0;
 }
@@ -1746,6 +1754,63 @@ uint32_t ltot;
 	return 0;
 }
 
+uint32_t
+drvLan9118TxPacketV(DrvLan9118_tps plan_ps, const void *hdr_pa, int hdrsz, const struct iovec *iov, int iovcnt, unsigned short tag)
+{
+uint32_t base = plan_ps->base;
+uint32_t need, cmda, cmdb, off, a;
+int      i, nbytes, last;
+
+	/* every buffer needs a TXCMD_A/B pair in addition to the data words */
+	need   = 8 + hdrsz;
+	nbytes = hdrsz;
+	last   = -1;
+	for ( i=0; i<iovcnt; i++ ) {
+		if ( 0 == iov[i].iov_len )
+			continue;
+		off     = (uint32_t)iov[i].iov_base & 3;
+		need   += 8 + ((off + iov[i].iov_len + 3) & ~3);
+		nbytes += iov[i].iov_len;
+		last    = i;
+	}
+
+	cmdb = TXCMD_B_TAG_SET(tag) | TXCMD_B_PKTLEN_SET(nbytes - EH_PAD_BYTES);
+
+	TXLOCK(plan_ps);
+
+	/* Verify space in the fifo */
+	if ( TX_FIFO_INF_TXDFREE_GET(rd9118Reg(base, TX_FIFO_INF)) < need ) {
+		/* not enough space */
+		TXUNLOCK(plan_ps);
+		return -1;
+	}
+
+	cmda = TXCMD_A_FIRST | TXCMD_A_BUFSIZ_SET(hdrsz - EH_PAD_BYTES) | TXCMD_A_START_ALIGN_SET(EH_PAD_BYTES);
+	if ( last < 0 )
+		cmda |= TXCMD_A_LAST;
+	wr9118Reg(base, TX_DATA_FIFO, cmda);
+	wr9118Reg(base, 32, cmdb);
+	drvLan9118FifoWr(plan_ps, hdr_pa, hdrsz);
+
+	for ( i=0; i<=last; i++ ) {
+		if ( 0 == iov[i].iov_len )
+			continue;
+		a    = (uint32_t)iov[i].iov_base;
+		off  = a & 3;
+		cmda = TXCMD_A_BUFSIZ_SET(iov[i].iov_len) | TXCMD_A_START_ALIGN_SET(off);
+		if ( i == last )
+			cmda |= TXCMD_A_LAST;
+		wr9118Reg(base, TX_DATA_FIFO, cmda);
+		wr9118Reg(base, 32, cmdb);
+		drvLan9118FifoWr(plan_ps, (void*)(a - off), (off + iov[i].iov_len + 3) & ~3);
+	}
+
+	DELAY180ns();
+	TXUNLOCK(plan_ps);
+
+	return 0;
+}
+
 void
 drvLan9118TxUnlock(DrvLan9118_tps plan_ps)
 {
@@ -1771,6 +1836,43 @@ uint32_t sz;
 					   (uint32_t)-1 == timeout ? RTEMS_NO_TIMEOUT : timeout );
 }
 
+void
+drvLan9118TxAvailCb(DrvLan9118_tps plan_ps, int nbytes, DrvLan9118CB_tpf cb, void *arg)
+{
+rtems_interrupt_level key;
+uint32_t              lvl;
+
+	/* level is in units of 64 bytes */
+	lvl = (nbytes + 63) >> 6;
+	if ( lvl > 0xff )
+		lvl = 0xff;
+
+	plan_ps->txa_cb_pf    = 0;
+	plan_ps->txa_cb_arg_p = arg;
+	plan_ps->txa_cb_pf    = cb;
+
+	rtems_interrupt_disable(key);
+		wr9118Reg(plan_ps->base, FIFO_INT,
+			(rd9118Reg(plan_ps->base, FIFO_INT) & ~FIFO_INT_TDFA_LVL_SET(0xff))
+			| FIFO_INT_TDFA_LVL_SET(lvl));
+	rtems_interrupt_enable(key);
+}
+
+void
+drvLan9118TxAvailArm(DrvLan9118_tps plan_ps)
+{
+rtems_interrupt_level key;
+
+	rtems_interrupt_disable(key);
+	if ( ! (TDFA_INT & plan_ps->int_msk) ) {
+		/* discard stale status; it would fire right away */
+		wr9118Reg(plan_ps->base, INT_STS, TDFA_INT);
+		plan_ps->int_msk |= TDFA_INT;
+		wr9118Reg(plan_ps->base, INT_EN, plan_ps->int_msk);
+	}
+	rtems_interrupt_enable(key);
+}
+
 /* Flush TX status and DATA fifos   */
 /* To be called from TX thread ONLY */
 #define STATUS_FIFO	(1<<15)
@@ -1965,6 +2067,22 @@ uint32_t	    int_sts, rx_sts, tx_sts, phy_sts;
 				plan_ps->stats_s.txp++;
 			}
 		}
+		if ( TDFA_INT & int_sts ) {
+			rtems_interrupt_level key;
+			/* one-shot; user re-arms with drvLan9118TxAvailArm() */
+			rtems_interrupt_disable(key);
+				plan_ps->int_msk &= ~TDFA_INT;
+				wr9118Reg(base, INT_EN, plan_ps->int_msk);
+			rtems_interrupt_enable(key);
+			/* ack now; the callback may re-arm before we clear int_sts below */
+			wr9118Reg(base, INT_STS, TDFA_INT);
+			int_sts &= ~TDFA_INT;
+			plan_ps->stats_s.tdfa++;
+			if ( plan_ps->txa_cb_pf )
+				plan_ps->txa_cb_pf(plan_ps,
+				                   TX_FIFO_INF_TXDFREE_GET(rd9118Reg(base, TX_FIFO_INF)),
+				                   plan_ps->txa_cb_arg_p);
+		}
 		if ( PHY_INT & int_sts ) {
 			REGLOCK(plan_ps);
 			drvLan9118_mdio_r(0, plan_ps, MII_INT_SRC, &phy_sts);
@@ -78,6 +78,7 @@
 #include <rtems.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 /* TX status word          */
 #define TXSTS_TAG_GET(x)	(((x)>>16)&0xffff)
@@ -315,6 +316,22 @@ drvLan9118BufRev(uint32_t *buf_p, int nwords);
 uint32_t
 drvLan9118TxPacket(DrvLan9118_tps plan_ps, const void *buf_p, int nbytes, unsigned short tag);
 
+/* Send a packet gathered from a header and 'iovcnt' data segments.
+ * The header (mandatory) must be word-aligned, its size a multiple
+ * of four and -- like the buffer passed to drvLan9118TxPacket() --
+ * it must start with 2 pad bytes which are not sent.
+ * The data segments need not be aligned; every segment is described
+ * to the chip by its own command word pair so that no copying is
+ * necessary. Empty segments are skipped.
+ * As with drvLan9118TxPacket() the words containing the first and
+ * last byte of each segment are read in their entirety.
+ *
+ * RETURNS: 0 on success, nonzero if there was not enough space in the FIFO.
+ *          The TX lock is released in any case.
+ */
+uint32_t
+drvLan9118TxPacketV(DrvLan9118_tps plan_ps, const void *hdr_p, int hdrsz, const struct iovec *iov, int iovcnt, unsigned short tag);
+
 /* Write n_bytes to TX fifo;
  * NOTE: TX lock must be held (call TxPacket routine first)
  */
@@ -357,6 +374,21 @@ drvLan9118TxUnlock(DrvLan9118_tps plan_ps);
 rtems_status_code
 drvLan9118TxStatus(DrvLan9118_tps plan_ps, uint32_t *pval_p, uint32_t timeout);
 
+/* Register a callback to be executed (from the daemon) when at least
+ * 'nbytes' (rounded up to 64-byte units) of TX data FIFO space are available.
+ * The callback's 'sts' argument is the number of free bytes in the FIFO.
+ *
+ * NOTES: The TX-data-available interrupt is one-shot; it must be armed
+ *        with drvLan9118TxAvailArm() every time the user wants to be
+ *        notified. Since the space may have become available before the
+ *        interrupt was armed the user should retry sending after arming.
+ */
+void
+drvLan9118TxAvailCb(DrvLan9118_tps plan_ps, int nbytes, DrvLan9118CB_tpf cb, void *arg);
+
+void
+drvLan9118TxAvailArm(DrvLan9118_tps plan_ps);
+
 /* Flush TX status and DATA fifos 
  * To be called from TX thread ONLY
  * RETURNS: time it took (5282 timer ticks), see source code; the
@@ -1,6 +1,7 @@
 
 /* fwd decl of interface struct */
 struct IpBscIfRec_;
+struct iovec;
 
 /* MACROS USED BY lanIpBasic.c;
  * These macros must be implemented by the driver so that the
@@ -45,11 +46,21 @@ struct IpBscIfRec_;
  * 'phdr' may be NULL if 'data' already contains the header.
  * There is nothing magic about the header -- this is just 'poor-man's gathering'
  * i.e., support for sending data from two non-contiguous areas.
+ * A nonzero 'tag' is reported back (txstatus_post()) once the
+ * chip has sent the packet.
  */
 static inline int 
-snd_packet_locked(struct IpBscIfRec_ *ipbif_p, void *phdr, int hdrsz, void *data, int dtasz);
+snd_packet_locked(struct IpBscIfRec_ *ipbif_p, void *phdr, int hdrsz, void *data, int dtasz, unsigned tag);
 
 #define NETDRV_SND_PACKET snd_packet_locked
+
+/* Like NETDRV_SND_PACKET but payload data are gathered from 'iovcnt'
+ * segments (total size 'dtasz'). The segments need not be aligned.
+ */
+static inline int
+snd_packetv_locked(struct IpBscIfRec_ *ipbif_p, void *phdr, int hdrsz, const struct iovec *iov, int iovcnt, int dtasz, unsigned tag);
+
+#define NETDRV_SND_PACKETV snd_packetv_locked
 /* Enqueue and send a buffer; in contrast to NETDRV_SND_PACKET() which
  * sends data out of arbitrary memory (and therefore always involves some
  * kind of copying) the buffer handed to NETDRV_ENQ_BUFFER() is a buffer
@@ -62,10 +73,33 @@ snd_packet_locked(struct IpBscIfRec_ *ipbif_p, void *phdr, int hdrsz, void *data
  */
 #define NETDRV_ENQ_BUFFER(ipbif_p, pbuf, nbytes)						\
 	do {																\
-		NETDRV_SND_PACKET((ipbif_p), 0, 0, pbuf, nbytes);				\
+		NETDRV_SND_PACKET((ipbif_p), 0, 0, pbuf, nbytes, 0);			\
 		relrbuf(pbuf);													\
 	} while (0)
 
+/* Try to send a buffer; in contrast to NETDRV_ENQ_BUFFER() the buffer
+ * is not released if there is no space in the FIFO (return value <= 0).
+ * This enables TX priority queueing in lanIpBasic.
+ */
+static inline int
+try_enq_buffer(struct IpBscIfRec_ *ipbif_p, void *pbuf, int nbytes);
+
+#define NETDRV_TRY_ENQ_BUFFER try_enq_buffer
+
+/* FIFO space (bytes) which must be available before the TX queues are
+ * drained after running out of room (see drvLan9118TxAvailCb()).
+ */
+#ifndef LAN9118_TXAVAIL_LEVEL
+#define LAN9118_TXAVAIL_LEVEL	1600
+#endif
+
+/* Request a drvLan9118IpTxAvailCb() call once FIFO space is available        */
+#define NETDRV_TX_WAKEUP(ipbif_p)										\
+	drvLan9118TxAvailArm((DrvLan9118_tps)((ipbif_p)->drv_p))
+
+/* TX status words are passed on to lanIpBasic (drvLan9118IpTxCb())           */
+#define NETDRV_TX_STATUS
+
 /* Read MAC address from device/driver into a buffer */
 #define NETDRV_READ_ENADDR(ipbif_p, buf)								\
 	drvLan9118ReadEnaddr((DrvLan9118_tps)(ipbif_p->drv_p), (buf))
@@ -95,7 +129,7 @@ NETDRV_SHUTDOWN(void * drv_p);
 
 /* Implement fwd-declared bits */
 static inline int 
-snd_packet_locked(IpBscIf ipbif_p, void *phdr, int hdrsz, void *data, int dtasz)
+snd_packet_locked(IpBscIf ipbif_p, void *phdr, int hdrsz, void *data, int dtasz, unsigned tag)
 {
 DrvLan9118_tps drv_p = (DrvLan9118_tps)ipbif_p->drv_p;
 int ltot;
@@ -108,7 +142,7 @@ int ltot;
 	assert( 0 == (hdrsz  & 3) && 0 == ((uint32_t)phdr & 3) && 0 == ((uint32_t)data & 3) );
 
 	if ( phdr ) {
-		if ( drvLan9118TxPacket(drv_p, 0, hdrsz+dtasz, 0) ) {
+		if ( drvLan9118TxPacket(drv_p, 0, hdrsz+dtasz, tag) ) {
 			return -ENOSPC;
 		}
 		drvLan9118FifoWr(drv_p, phdr, hdrsz);
@@ -116,7 +150,27 @@ int ltot;
 		drvLan9118TxUnlock(drv_p);
 		return dtasz;
 	}
-	return drvLan9118TxPacket(drv_p, data, dtasz, 0) ? -ENOSPC : dtasz;
+	return drvLan9118TxPacket(drv_p, data, dtasz, tag) ? -ENOSPC : dtasz;
+}
+
+static inline int
+snd_packetv_locked(IpBscIf ipbif_p, void *phdr, int hdrsz, const struct iovec *iov, int iovcnt, int dtasz, unsigned tag)
+{
+	assert( 0 == (hdrsz  & 3) && 0 == ((uint32_t)phdr & 3) );
+
+	return drvLan9118TxPacketV((DrvLan9118_tps)ipbif_p->drv_p, phdr, hdrsz, iov, iovcnt, tag) ? -ENOSPC : dtasz;
+}
+
+static inline int
+try_enq_buffer(IpBscIf ipbif_p, void *pbuf, int nbytes)
+{
+int rval;
+	if ( (rval = snd_packet_locked(ipbif_p, 0, 0, pbuf, nbytes, ((rbuf_t*)pbuf)->buf.txtag)) > 0 ) {
+		/* status is now reported by the chip */
+		((rbuf_t*)pbuf)->buf.txtag = 0;
+		relrbuf(pbuf);
+	}
+	return rval;
 }
 
 /* Implement high-level routines (how to create, start, shutdown driver);
@@ -178,6 +232,24 @@ rbuf_t			*prb;
 	return (len);
 }
 
+/* Every TX status indicates that FIFO space was freed */
+int
+drvLan9118IpTxCb(DrvLan9118_tps drv_p, uint32_t sts, void *arg)
+{
+	if ( TXSTS_TAG_GET(sts) )
+		txstatus_post((IpBscIf)arg, TXSTS_TAG_GET(sts), (TXSTS_ERROR & sts) ? -EIO : 0);
+	txprio_drain((IpBscIf)arg);
+	return 0;
+}
+
+/* TX FIFO has room again */
+int
+drvLan9118IpTxAvailCb(DrvLan9118_tps drv_p, uint32_t nbytes, void *arg)
+{
+	txprio_drain((IpBscIf)arg);
+	return 0;
+}
+
 LanIpBscDrv
 lanIpBscDrvCreate(int instance, uint8_t *enaddr_p)
 {
@@ -193,9 +265,10 @@ DrvLan9118_tps drv_p = lanIpBscIfGetDrv(ipbif_p);
 	rtems_error(RTEMS_NOT_DEFINED,"drvLan9118IpBasic: driver not attached to interface yet?");  		
 	return RTEMS_NOT_DEFINED;
   }
+  drvLan9118TxAvailCb(drv_p, LAN9118_TXAVAIL_LEVEL, drvLan9118IpTxAvailCb, ipbif_p);
   return drvLan9118Start(drv_p, pri, 0,
                 drvLan9118IpRxCb, ipbif_p,
-                0, 0,
+                drvLan9118IpTxCb, ipbif_p,
                 0, 0,
                 0, 0);
 }
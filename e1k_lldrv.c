@@ -154,7 +154,9 @@ struct e1k_private {
 		uint32_t             irqs_spr;
 		uint32_t             txpkt;
 		uint32_t             rxpkt;
+		uint32_t             txdbell;
 	}                        stats;
+	int                      tdt_pend; /* TDT write deferred */
 	rtems_irq_connect_data   irq;
 	int                      link_active;
 	uint16_t                 link_speed, link_duplex;
@@ -371,11 +373,12 @@ drv_e1k_dump_stats(struct e1k_private *ad, FILE *f)
 		f = stdout;
 
 	fprintf(f,
-		"E1K # IRQS: %9"PRIu32" (spurious %9"PRIu32")\n    RX-FRM: %9"PRIu32",  TX-FRM: %9"PRIu32"\n",
+		"E1K # IRQS: %9"PRIu32" (spurious %9"PRIu32")\n    RX-FRM: %9"PRIu32",  TX-FRM: %9"PRIu32"\n    TDT writes: %9"PRIu32"\n",
 		ad->stats.irqs,
 		ad->stats.irqs_spr,
 		ad->stats.rxpkt,
-		ad->stats.txpkt
+		ad->stats.txpkt,
+		ad->stats.txdbell
 	);
 }
 
@@ -1045,8 +1048,9 @@ int                    err;
 	return rval;
 }
 
-int
-drv_e1k_send_buf(struct e1k_private *ad, void *p_usr, void *buf, int len)
+/* Fill a TX descriptor but don't tell the chip yet                          */
+static int
+e1k_enq_buf(struct e1k_private *ad, void *p_usr, void *buf, int len)
 {
 struct   e1000_leg_desc *d;
 
@@ -1075,11 +1079,48 @@ struct   e1000_leg_desc *d;
 	if ( ++ad->tx_ring.tl == ad->tx_ring.sz )
 		ad->tx_ring.tl = 0;
 
-	E1000_WRITE_REG(&ad->hw, E1000_TDT, ad->tx_ring.tl);
-
 	return len;
 }
 
+/* Pass descriptors filled by drv_e1k_send_buf_more() to the chip; every
+ * TDT write is a (slow) PCI transaction.
+ */
+void
+drv_e1k_tx_flush(struct e1k_private *ad)
+{
+	if ( ad->tdt_pend ) {
+		ad->tdt_pend = 0;
+		ad->stats.txdbell++;
+		E1000_WRITE_REG(&ad->hw, E1000_TDT, ad->tx_ring.tl);
+	}
+}
+
+int
+drv_e1k_send_buf(struct e1k_private *ad, void *p_usr, void *buf, int len)
+{
+int rval;
+
+	if ( (rval = e1k_enq_buf(ad, p_usr, buf, len)) > 0 )
+		ad->tdt_pend = 1;
+
+	/* flush even if we failed; caller may rely on earlier bufs going out */
+	drv_e1k_tx_flush(ad);
+
+	return rval;
+}
+
+/* More packets follow; defer the TDT write until drv_e1k_tx_flush()       */
+int
+drv_e1k_send_buf_more(struct e1k_private *ad, void *p_usr, void *buf, int len)
+{
+int rval;
+
+	if ( (rval = e1k_enq_buf(ad, p_usr, buf, len)) > 0 )
+		ad->tdt_pend = 1;
+
+	return rval;
+}
+
 void
 drv_e1k_read_eaddr(struct e1k_private *ad, unsigned char *eaddr)
 {
@@ -1499,6 +1540,8 @@ static struct IpBscLLDrv_ lldrv_e1k = {
 	swipe_tx      :  drv_e1k_swipe_tx,
 	swipe_rx      :  drv_e1k_swipe_rx,
 	send_buf      :  drv_e1k_send_buf,
+	send_buf_more :  drv_e1k_send_buf_more,
+	tx_flush      :  drv_e1k_tx_flush,
 	med_ioctl     :  drv_e1k_media_ioctl,
 	mc_filter_add :  drv_e1k_mcast_filter_accept_add,
 	mc_filter_del :  drv_e1k_mcast_filter_accept_del,
@@ -53,6 +53,10 @@ struct IpBscLLDrv_ {
 	int         (*swipe_tx)(LLDev);   /* cleanup/free TX buffers swiping ring    */
 	int         (*swipe_rx)(LLDev);   /* swipe RX ring, call 'consume_rxbuf'     */
 	int         (*send_buf)(LLDev, void*, void*, int); /* enqueue buf for TX     */
+	int         (*send_buf_more)(LLDev, void*, void*, int); /* like send_buf but */
+	                                  /* more bufs follow; the chip need not be   */
+	                                  /* notified before 'tx_flush' (OPTIONAL)    */
+	void        (*tx_flush)(LLDev);   /* notify chip of deferred bufs (OPTIONAL) */
 	int         (*med_ioctl)(LLDev, int, int*); /* obtain media state            */
 	void        (*mc_filter_add)(LLDev, uint8_t*); /* add addr to mcast filter   */
 	void        (*mc_filter_del)(LLDev, uint8_t*); /* del addr from mcast filter */
@@ -4,7 +4,7 @@
  *
  *  - trivial ARP
  *  - ICMP echo request (ping) handling
- *  - IGMP (v2)
+ *  - IGMP (v3 incl. source filters; falls back to v2/v1)
  *  - trivial IP (only 20byte header)
  *  - basic UDP (no checksum)
  *
@@ -41,9 +41,7 @@
 
 #include <lhtbl.h>
 
-#ifdef ENABLE_PROFILE
 #include "hwtmr.h"
-#endif
 
 /* include netdriver AFTER defining VIOLATE_KERNEL_VISIBILITY (in case it uses
  * rtems.h already)
@@ -62,6 +60,16 @@
 #define IGMP_TYPE_REPORT_V1 0x12
 #define IGMP_TYPE_REPORT_V2 0x16
 #define IGMP_TYPE_LEAVE     0x17
+#define IGMP_TYPE_REPORT_V3 0x22
+
+/* IGMPv3 group record types                                                  */
+#define IGMP_REC_IS_IN      1
+#define IGMP_REC_IS_EX      2
+#define IGMP_REC_TO_IN      3
+#define IGMP_REC_TO_EX      4
+
+/* Max. # of sources in a IGMPv3 report (single record, one ethernet frame)  */
+#define IGMP_V3_MAXSRC      ((1500 - 24 - sizeof(IgmpV3ReportHeaderRec) - sizeof(IgmpV3GroupRecRec))/4)
 
 /* IPv4 options                                                               */
 #define IP_OPT_ROUTER_ALERT	0x94040000
@@ -96,6 +104,65 @@
 #define ARP_TIMEOUT_TICKS    ((rtems_interval)1) /* Ticks                     */
 #endif
 
+/* Packets of non-blocking senders waiting for an ARP reply: max. number held
+ * per IF and per destination.
+ */
+#ifndef ARP_HOLD_MAX
+#define ARP_HOLD_MAX    32
+#endif
+#ifndef ARP_HOLD_PERDST
+#define ARP_HOLD_PERDST  4
+#endif
+
+/* While packets are held the ARP request is repeated every ARP_HOLD_PERIOD
+ * ticks; packets are dropped after ARP_SEND_RETRY periods w/o reply.
+ */
+#ifndef ARP_HOLD_PERIOD
+#define ARP_HOLD_PERIOD 10
+#endif
+
+/* Default ARP aging policy of a new IF (seconds; see arpSetAging()).
+ * An ARP_AGE_MAXAGE of 0 disables aging.
+ */
+#ifndef ARP_AGE_MAXAGE
+#define ARP_AGE_MAXAGE   0
+#endif
+#ifndef ARP_AGE_PROBE
+#define ARP_AGE_PROBE    0
+#endif
+
+/* Default # of gratuitous ARP announcements sent when an IF is created and
+ * interval between them (ms); run-time configurable (see lanIpBscConfig()).
+ */
+#ifndef ARP_GARP_COUNT
+#define ARP_GARP_COUNT   0
+#endif
+#ifndef ARP_GARP_IVAL
+#define ARP_GARP_IVAL    1000
+#endif
+
+/* Default number of preallocated ARP sync semaphores (run-time configurable;
+ * see lanIpBscConfig()).
+ */
+#ifndef ARP_NSEMS
+#define ARP_NSEMS        8
+#endif
+
+/* Default for lanIpBscAutoRefreshARPTicks                                    */
+#ifndef ARP_REFRESH_TICKS
+#define ARP_REFRESH_TICKS 100
+#endif
+
+/* Max. # of ARP requests sent per tick to revalidate restored entries        */
+#ifndef ARP_REVAL_PERTICK
+#define ARP_REVAL_PERTICK 4
+#endif
+
+/* # of recently scheduled refreshes remembered (power of 2)                  */
+#ifndef ARP_RFPEND_SZ
+#define ARP_RFPEND_SZ    16
+#endif
+
 /* Minimal alignment of RBUFs; fall back on packet alignment if undefined     */
 #if     RBUF_ALIGNMENT < LAN_IP_BASIC_PACKET_ALIGNMENT
 #undef  RBUF_ALIGNMENT
@@ -103,11 +170,17 @@
 #endif
 
 /* How many overflow buckets should the ARP hash algorithm use                */
-/* FIXME: should we use a shtbl lhtbl for this?                               */
 #ifndef CACHE_OVERLAP
 #define CACHE_OVERLAP 10
 #endif
 
+/* Default number of ARP cache slots (run-time configurable; see
+ * lanIpBscConfig()). Rounded up to a power of two.
+ */
+#ifndef ARP_CACHESZ
+#define ARP_CACHESZ   256
+#endif
+
 /* How many RBUFs to configure initially - more can be added at run-time      */
 #ifndef NRBUFS
 #define NRBUFS		50	/* Initial total number of RX buffers                 */
@@ -119,11 +192,90 @@
 #define NSOCKS		5
 #endif
 
+/* # of (log2) bins of the TX latency histograms (udpSockSetTxLatency())     */
+#ifndef UDP_LATHIST_NBINS
+#define UDP_LATHIST_NBINS	24
+#endif
+
 /* RX socket queue depth (initial/default value).                             */
 #ifndef QDEPTH
 #define QDEPTH		20
 #endif
 
+/* Number of strict-priority TX classes; class 0 has the highest priority     */
+#ifndef TXPRIO_NCLASSES
+#define TXPRIO_NCLASSES	4
+#endif
+
+/* TX priority class new sockets are assigned to                              */
+#ifndef TXPRIO_DEFLT
+#define TXPRIO_DEFLT	1
+#endif
+
+/* Max. number of packets each TX priority class may hold back                */
+#ifndef TXPRIO_QDEPTH
+#define TXPRIO_QDEPTH	16
+#endif
+
+/* # of prebuilt headers each unconnected socket caches for 'sendto'
+ * (0 disables the cache).
+ */
+#ifndef UDP_DSTCACHE_SZ
+#define UDP_DSTCACHE_SZ	4
+#endif
+
+/* Max. # of tagged packets (udpSockSendTagged()) in flight on an interface   */
+#ifndef TXSTS_NTAGS
+#define TXSTS_NTAGS		32
+#endif
+
+/* Max. # of packets in flight whose completion is only tracked for latency
+ * histograms (see udpSockSetTxLatency()); a separate pool so that these
+ * never starve udpSockSendTagged()
+ */
+#ifndef TXSTS_NLATTAGS
+#define TXSTS_NLATTAGS	16
+#endif
+
+/* # of IP datagrams each interface may reassemble concurrently
+ * (0 disables IP fragmentation and reassembly).
+ */
+#ifndef IP_REASM_NENTRIES
+#define IP_REASM_NENTRIES	4
+#endif
+
+/* Max. # of fragments per datagram; this bounds the datagram size and
+ * the number of rbufs held by the reassembly table.
+ */
+#ifndef IP_REASM_MAXFRAGS
+#define IP_REASM_MAXFRAGS	8
+#endif
+
+/* Incomplete datagrams are discarded after this many milliseconds           */
+#ifndef IP_REASM_TIMEOUT_MS
+#define IP_REASM_TIMEOUT_MS	500
+#endif
+
+/* Highest IGMP version we use (3 or 2); we fall back to older versions if
+ * an older querier is present. With version 2 source filters are only
+ * enforced locally.
+ */
+#ifndef IGMP_VERSION
+#define IGMP_VERSION	3
+#endif
+
+/* Max. # of sources per socket and group (udpSockJoinMcastSrc())            */
+#ifndef MC_SRCFILT_MAX
+#define MC_SRCFILT_MAX	64
+#endif
+
+/* # bits of the multicast membership prefilter (power of 2); received
+ * datagrams for groups whose bit is clear are rejected w/o a hash lookup.
+ */
+#ifndef MC_PREFILT_BITS
+#define MC_PREFILT_BITS	1024
+#endif
+
 /* Port # where we start to assign when the user tells us to pick a free port */
 #ifndef DEFLT_PORT
 #define DEFLT_PORT  31110
@@ -137,6 +289,7 @@
 /* Special IPv4 multicast addresses                                           */
 #define IP_GRP_ALL_SYSTEMS  0xe0000001
 #define IP_GRP_ALL_ROUTERS  0xe0000002
+#define IP_GRP_ALL_V3RTRS   0xe0000016
 	
 /* Check if a IP address 'ip' is a broadcast address (netmask 'nm')           */
 #define ISBCST(ip,nm)  (((ip) & ~(nm)) == ~(nm))
@@ -234,7 +387,13 @@ struct _rbuf_ {
 	struct timespec   tstmp;
 	IpBscIf           intrf;
 	union rbuf_       *next;
+	uint32_t          txstmp;   /* hwtimer when held back in a TX queue;  */
+	                            /* tick when held for ARP resolution      */
+	uint16_t          txlen;    /* frame length while held in a TX queue  */
+	uint16_t          txtag;    /* TX status tag (0 if none)              */
+	union rbuf_       *frag;    /* Next fragment of a reassembled datagram*/
 	uint8_t          refcnt;
+	uint8_t          txprio;    /* TX priority class while held for ARP   */
 };
 
 typedef union rbuf_ {
@@ -256,6 +415,7 @@ typedef struct ArpEntryRec_ {
                                       /* valid if sync_resp == 0)             */
 
 	rtems_interval	ctime;            /* 'age' of this record (ARPREP seen)   */       
+	rtems_interval  rtime;            /* tick when 'hwaddr' was last stored   */
 	rtems_id        sync_resp;        /* sem to block for ARPREP arrival      */
 } ArpEntryRec, *ArpEntry;
 
@@ -263,6 +423,13 @@ typedef struct ArpEntryRec_ {
 #define ARP_PERM	((rtems_interval)(-1))
 
 
+/* Source filter (sorted list of source addresses)                           */
+typedef struct McSrcFiltRec_ {
+	int             mode;      /* LANIP_MCAST_INCLUDE or LANIP_MCAST_EXCLUDE  */
+	unsigned        nsrc;      /* # of sources                                */
+	uint32_t        srcs[];    /* Source addresses (network byte order)       */
+} McSrcFiltRec, *McSrcFilt;
+
 /* Struct describing a multicast address (MCA)                                */
 
 typedef struct IpBscMcAddrRec_ {
@@ -271,8 +438,15 @@ typedef struct IpBscMcAddrRec_ {
 	uint32_t        mc_addr;   /* IPv4 multicast address                      */
 	uint16_t		mc_sobs;   /* Bitset of sockets having joined this MCA    */
 	uint16_t        mc_flags;  /* Flags                                       */
+	McSrcFilt       mc_sf[NSOCKS]; /* Socket filters (NULL: EXCLUDE {})       */
+	McSrcFilt       mc_iff;    /* Merged filter of the IF (NULL: EXCLUDE {})  */
 } IpBscMcAddrRec, *IpBscMcAddr;
 
+/* Filters are modified under MCLOCK; the RX path reads them with dispatching
+ * disabled and old filters are released by the (task) modifying them, i.e.,
+ * readers never see a filter after it was freed.
+ */
+
 /* Multiple sockets may subscribe to the same MCA (but each socket only once).
  * The 'mc_sobs' field keeps track of all the sockets that have subscribed to
  * this MCA. Each socket sets (1<<sd) in this bitfield when joining and clears
@@ -282,6 +456,10 @@ typedef struct IpBscMcAddrRec_ {
 
 /* State flag indicating whether we should send a IGMP leave message          */
 #define MC_FLG_IGMP_LEAVE	(1<<0)
+/* IGMPv3: next report is a state-change (TO_IN/TO_EX) report                 */
+#define MC_FLG_IGMP_CHG 	(1<<1)
+/* Some socket has set a source filter (counted in the IF's 'mcnsf')          */
+#define MC_FLG_SRCFILT  	(1<<2)
 
 /* 'Special' sd to prevent 224.0.0.1 to be ever deleted                       */
 #define MC_ALLSYS_SD        15
@@ -290,6 +468,10 @@ typedef struct IpBscMcAddrRec_ {
 #error "MC_ALLSYS_SD clashes with normal sockets"
 #endif
 
+#if ( (MC_PREFILT_BITS) < 32 ) || ( (MC_PREFILT_BITS) & ((MC_PREFILT_BITS) - 1) )
+#error "MC_PREFILT_BITS must be a power of 2 and >= 32"
+#endif
+
 /* Reference a MCA either as a MCA or a opaque list node                      */
 typedef union IpBscMcRef_ {
 	LanIpLstNode	r_node;
@@ -303,6 +485,22 @@ typedef struct IpBscIfStatsRec_ {
 	uint32_t    eth_rxdropped;
 	uint32_t    eth_txrawfrm;
 	uint32_t	arp_nosem;            /* failed to create ARP sync semaphore  */
+	uint32_t    arp_semdyn;           /* sync sem. created (pool exhausted)   */
+	uint32_t    arp_evicted;          /* entries evicted to make room         */
+	uint32_t    arp_nospc;            /* no evictable slot found              */
+	uint32_t    arp_lkfast;           /* lookups served w/o taking the lock   */
+	uint32_t    arp_lklocked;         /* lookups that had to take the lock    */
+	uint32_t    arp_held;             /* packets held waiting for ARP reply   */
+	uint32_t    arp_holdsent;         /* held packets sent after reply        */
+	uint32_t    arp_holdtimo;         /* held packets dropped (no reply)      */
+	uint32_t    arp_holddropped;      /* packets dropped (hold queue full)    */
+	uint32_t    arp_probes;           /* unicast refresh requests sent        */
+	uint32_t    arp_aged;             /* entries expired by aging             */
+	uint32_t    arp_rfsched;          /* RX refreshes passed to lpWorker      */
+	uint32_t    arp_rfskipped;        /* RX refreshes skipped (entry fresh)   */
+	uint32_t    arp_loaded;           /* entries stored by arpLoad()          */
+	uint32_t    arp_reval;            /* requests sent to revalidate them     */
+	uint32_t    arp_garp;             /* gratuitous ARP announcements sent    */
 	uint32_t    arp_gotrep;
 	uint32_t    arp_reqme;
 	uint32_t    arp_reqother;
@@ -312,10 +510,16 @@ typedef struct IpBscIfStatsRec_ {
 	uint32_t    arp_txrep;
 	uint32_t    ip_dstdropped;
 	uint32_t    ip_mcdstdropped;
+	uint32_t    ip_mcsrcdropped;      /* MC source not passing the filter     */
 	uint32_t    ip_rxufrm;
 	uint32_t    ip_rxmfrm;
 	uint32_t    ip_rxbfrm;
 	uint32_t    ip_frgdropped;
+	uint32_t    ip_rxfrag;            /* fragments accepted for reassembly    */
+	uint32_t    ip_reasmok;           /* datagrams reassembled                */
+	uint32_t    ip_reasmdropped;      /* fragments dropped (bad/table full)   */
+	uint32_t    ip_reasmtimo;         /* incomplete datagrams timed out       */
+	uint32_t    ip_txfrag;            /* fragments sent                       */
 	uint32_t    ip_lendropped;
 	uint32_t    ip_protdropped;
 	uint32_t    ip_txmcloopback;
@@ -331,8 +535,10 @@ typedef struct IpBscIfStatsRec_ {
 	uint32_t    igmp_rxreportv2;
 	uint32_t    igmp_rxqueryv1;
 	uint32_t    igmp_rxqueryv2;
+	uint32_t    igmp_rxqueryv3;
 	uint32_t    igmp_txreportv1;
 	uint32_t    igmp_txreportv2;
+	uint32_t    igmp_txreportv3;
 	uint32_t    igmp_txleave;
 	uint32_t    udp_hdrdropped;
 	uint32_t    udp_sadropped;
@@ -342,47 +548,100 @@ typedef struct IpBscIfStatsRec_ {
 	uint32_t    udp_txfrm;
 	uint32_t    udp_txdropped;
 	uint32_t    udp_txbytes;
+	uint32_t    udp_dchit;            /* 'sendto' dest. header cache hits     */
+	uint32_t    udp_dcmiss;           /* 'sendto' dest. header cache misses   */
+	uint32_t    udp_txsts;            /* TX status records delivered          */
+	uint32_t    udp_txstserr;         /* TX status records reporting errors   */
+	uint32_t    udp_txstsdropped;     /* TX status queue full or no tag avail.*/
 } IpBscIfStatsRec, *IpBscIfStats;
 
-/* NOTES: On class C networks (or equivalent A/B subnets) there will never be
- *        collisions in the cache.
- *
- *        Dont change size (256) w/o adapting hashing algorithm and w/o changing
- *        the 'modulo 256' operation implicit into declaring the 'h' loopcounter
- *        as uint8_t.
+/* NOTES: The ARP cache is an open-addressing hash table with 'arpmsk' + 1
+ *        (a power of two, chosen when the IF is created) slots. An entry
+ *        lives in one of the CACHE_OVERLAP slots following its hash index
+ *        (modulo the cache size).
  *
- *        When scanning for a free slot the algorithm (arp_find_or_add()) keeps
- *        track of the oldest entry which -- if such an entry is found and no
- *        free slots are available -- is then evicted.
+ *        The hash multiplies the (host-order) address with the golden ratio
+ *        and uses the upper bits ('Fibonacci hashing') so that neighboring
+ *        addresses are spread over the whole table and all address bits
+ *        contribute.
  *
- *        The algorithm needs a special 'null'-element to catch the case where
- *        no oldest entry can be found (because there are only permanent slots
- *        in the neighborhood). The 'ARP_SENTINEL' -- which must be a permanent
- *        entry -- serves this purpose.
- *        The 'sentinel' must have a IP-address which never matches and must be
- *        flagged 'permanent'. The all-zero IP address should be OK.
+ *        When scanning for a free slot the algorithm (arp_find_or_add())
+ *        keeps track of the least-recently used non-permanent entry which --
+ *        if no free slot is available -- is then evicted. The last-use
+ *        time of every slot is recorded in 'arpatime' (written by lookups
+ *        w/o holding the lock; this is benign since the array is never
+ *        freed while the IF exists and a stale time only affects the
+ *        choice of victim).
  */
-#define ARP_CACHESZ   256
-
-/* index of sentinel; NOTE: unreachable by ordinary uint8_t hash index        */
-#define ARP_SENTINEL (256)            
+typedef ArpEntry *ArpCache;
+typedef unsigned  ArpHash;
 
-typedef ArpEntry ArpCache[ARP_CACHESZ + 1];
-typedef uint8_t  ArpHash;
+/* Next slot (modulo cache size)                                             */
+#define ARPNEXT(pif, h)	(((h) + 1) & (pif)->arpmsk)
 
-/* Don't bother about MSBs; assume we're on a LAN anyways                     */
-static inline ArpHash ARPHASH(uint32_t ipaddr)
-{
-ArpHash h;
-#ifdef BYTE_ORDER_UNKOWN
-	ipaddr = htohl(ipaddr);
-#elif  BYTE_ORDER == LITTLE_ENDIAN
-	ipaddr >>= 16;
-#endif
-	h  = ipaddr;
-	h += ipaddr >> 8;
-	return h;
-}
+/* Software TX queue for one priority class. Packets are held back here while
+ * the driver has no room (descriptors or FIFO space) for them and are handed
+ * to the driver strictly by priority as room becomes available.
+ */
+typedef struct TxPrioQRec_ {
+	rbuf_t          *head;
+	rbuf_t          *tail;
+	unsigned        nbufs;            /* # packets currently held back        */
+	uint32_t        txfrm;            /* # packets passed to the driver       */
+	uint32_t        held;             /* # packets that could not go out asap */
+	uint32_t        dropped;          /* # packets dropped (queue full)       */
+	uint32_t        blocked;          /* # times a sender waited for room     */
+	uint32_t        maxdly;           /* max. queueing delay (hwtimer ticks)  */
+	uint64_t        sumdly;           /* accumulated queueing delay           */
+} TxPrioQRec, *TxPrioQ;
+
+/* Tagged packet in flight; the status is reported to socket 'sd' when the
+ * driver is done with the packet.
+ */
+typedef struct TxTagRec_ {
+	volatile int    inuse;
+	int             sd;
+	unsigned        sgen;             /* socket 'gen' when the tag was issued */
+	uint32_t        cookie;           /* user's cookie                        */
+	int             len;              /* payload length                       */
+	int             lat;              /* record completion latency            */
+	int             nosts;            /* latency only; don't report status    */
+	uint32_t        t0;               /* hwtimer at send entry                */
+	LanIpRegion     rgn;              /* region slice to complete (or NULL)   */
+	void            *rptr;            /* start of the slice                   */
+} TxTagRec, *TxTag;
+
+/* Registered application memory region                                      */
+typedef struct LanIpRegionRec_ {
+	uint8_t             *base;
+	size_t              size;
+	LanIpRegionDoneProc done;         /* called when a slice is no longer used*/
+	void                *closure;
+	volatile unsigned   inflight;     /* # slices not completed yet           */
+} LanIpRegionRec;
+
+/* IP datagram being reassembled; an entry is in use while 'frags' is
+ * non-NULL.
+ */
+typedef struct IpReasmRec_ {
+	rbuf_t          *frags;           /* Fragments, sorted by offset          */
+	uint32_t        src;              /* Datagram identification: src, dst, id*/
+	uint32_t        dst;
+	uint16_t        id;
+	uint16_t        nfrags;
+	int             have;             /* # payload bytes received so far      */
+	int             total;            /* Payload size (0 until last frag seen)*/
+	unsigned        gen;              /* Identifies the timeout callout       */
+	IpBscIf         pif;
+	LanIpCalloutRec timo;             /* Discards incomplete datagram         */
+} IpReasmRec, *IpReasm;
+
+/* Refresh of an ARP entry scheduled from the RX path                         */
+typedef struct ArpRfPendRec_ {
+	uint32_t        ipaddr;
+	rtems_interval  tick;
+	uint8_t         hwaddr[6];
+} ArpRfPendRec;
 
 /* Interface struct                                                           */
 typedef struct IpBscIfRec_ {
@@ -396,13 +655,91 @@ typedef struct IpBscIfRec_ {
 	IpBscMcRef      mclist;           /* Linked list of all MCAs set on IF    */
 	IpBscMcAddr     mcallsys;         /* Special 'all-systems' MCA            */
 	LanIpCalloutRec mcIgmpV1RtrSeen;  /* Callout for IGMPv1-router-seen state */
+	LanIpCalloutRec mcIgmpV2RtrSeen;  /* Callout for IGMPv2-router-seen state */
+	unsigned        mcnsf;            /* # MCAs with source filters           */
 	unsigned        mcnum;	          /* Number of MC groups we joined        */
+	uint32_t        mcpref[MC_PREFILT_BITS/32]; /* Prefilter: bit set if a
+	                                   * group we joined maps to it
+	                                   * (modified under MCLOCK)
+	                                   */
 	IpBscIfStatsRec	stats;            /* IF statistics                        */
+	rtems_id        txmutx;           /* Mutex protecting TX priority queues  */
+	volatile unsigned txqpend;        /* # packets held in TX priority queues */
+	TxPrioQRec      txq[TXPRIO_NCLASSES]; /* Strict-priority TX queues        */
+	rtems_id        txwsem;           /* Senders wait here for queue room     */
+	volatile unsigned txwaiters;      /* # senders waiting on 'txwsem'        */
+	volatile uint32_t arpgen;         /* Bumped when a cached MAC changes     */
+	unsigned        txtagnxt;         /* Where to start looking for free tag  */
+	unsigned        txlatnxt;         /* Same for latency-only tags           */
+	TxTagRec        txtags[TXSTS_NTAGS + TXSTS_NLATTAGS]; /* Tagged packets in */
+	                                  /* flight; latency-only ones at the end */
+#if IP_REASM_NENTRIES > 0
+	uint16_t        ipid;             /* IP ID of next fragmented datagram    */
+	IpReasmRec      reasm[IP_REASM_NENTRIES]; /* Datagrams being reassembled */
+#endif
 	ArpCache        arphtbl;          /* Arp hash-table/cache                 */
+	volatile uint32_t *arpseq;        /* Per-slot write sequence              */
+	volatile rtems_interval *arpatime;/* Per-slot last-use (ticks)            */
+	unsigned        arpmsk;           /* # ARP cache slots - 1                */
+	unsigned        arpshft;          /* 32 - log2(# ARP cache slots)         */
+	rbuf_t          *arphold;         /* Packets waiting for ARP resolution   */
+	unsigned        arpnhold;         /* # packets on 'arphold'               */
+	LanIpCalloutRec arpholdco;        /* Repeats requests, expires packets    */
+	uint32_t        arpmaxage;        /* Aging: max. age of entries (s)       */
+	uint32_t        arpprobe;         /* Aging: probe window before expiry (s)*/
+	int             arpagenxt;        /* Aging: next slot to inspect          */
+	LanIpCalloutRec arpageco;         /* Aging: periodic sweep                */
+	ArpRfPendRec    arprfpend[ARP_RFPEND_SZ]; /* Recently scheduled refreshes */
+	uint32_t        *arprevl;         /* Loaded addresses to revalidate       */
+	unsigned        arprevn;          /* # addresses on 'arprevl'             */
+	unsigned        arprevi;          /* Next address to revalidate           */
+	LanIpCalloutRec arprevco;         /* Sends revalidation requests          */
+	unsigned        arpgarpn;         /* # announcements still to be sent     */
+	rtems_interval  arpgarpival;      /* Ticks between announcements          */
+	LanIpCalloutRec arpgarpco;        /* Sends gratuitous ARP announcements   */
 } IpBscIfRec;
 
 /* Macro for easy access of arp-table (historic reasons)                      */
 #define arpcache(pif)   ((pif)->arphtbl)
+#define arpcachesz(pif) ((int)(pif)->arpmsk + 1)
+
+static inline ArpHash ARPHASH(IpBscIf pif, uint32_t ipaddr)
+{
+	return (ntohl(ipaddr) * 0x9e3779b1) >> pif->arpshft;
+}
+
+/* Lock-free ARP cache readers: writers (holding the ARP lock) make the
+ * sequence count of every slot they might modify odd while modifying.
+ * A reader accepts what it read from a slot only if the slot's count
+ * was even and did not change meanwhile; otherwise it falls back to
+ * taking the lock (never spin: the writer could be a lower-priority task).
+ * Entries may be freed while a reader looks at them -- this is harmless
+ * since the reader then finds the count changed (no MMU protection
+ * of the heap).
+ * We are on a uniprocessor; a compiler barrier is all that's needed.
+ */
+#define ARP_BARRIER()	__asm__ __volatile__("":::"memory")
+
+/* Open/close slots 'h'..'h'+'n'-1 (modulo cache size) for modification   */
+static inline void
+arp_wopen(IpBscIf pif, ArpHash h, int n)
+{
+	while ( n-- > 0 ) {
+		pif->arpseq[h]++;
+		h = ARPNEXT(pif, h);
+	}
+	ARP_BARRIER();
+}
+
+static inline void
+arp_wclose(IpBscIf pif, ArpHash h, int n)
+{
+	ARP_BARRIER();
+	while ( n-- > 0 ) {
+		pif->arpseq[h]++;
+		h = ARPNEXT(pif, h);
+	}
+}
 
 /* Lock/unlock the IF's ARP cache                                             */
 #define ARPLOCK(pif)	mutex_lock((pif)->mutx)
@@ -415,6 +752,30 @@ typedef struct IpBscIfRec_ {
 /* Macro for easy access to arp packet layout                                 */
 #define arprep          arpbuf->pkt.p_u.arp_S
 
+/* Prebuilt header for sending to a particular destination from an unconnected
+ * socket. The entry is only valid while the IF's 'arpgen' still matches.
+ */
+typedef struct UdpDstCacheRec_ {
+	uint32_t          ipaddr;         /* Destination IP (network byte order)  */
+	uint16_t          dport;          /* Destination port (network byte order)*/
+	uint32_t          arpgen;         /* IF 'arpgen' when MAC was looked up   */
+	uint32_t          lru;            /* Time of last use (socket's 'dcclock')*/
+	uint32_t          csum;           /* IP hdr. csum partial (w/o len, csum) */
+	LanUdpPktRec      hdr;            /* Prebuilt ethernet/IP/UDP header      */
+} UdpDstCacheRec, *UdpDstCache;
+
+/* TX latency histograms of a socket; bin 'i' counts latencies
+ * 2^(i-1) <= t < 2^i hwtimer ticks (the last bin also counts all longer
+ * ones).
+ */
+typedef struct UdpLatHistRec_ {
+	uint32_t          acc[UDP_LATHIST_NBINS]; /* send entry -> driver/queue   */
+	uint32_t          cmp[UDP_LATHIST_NBINS]; /* send entry -> TX completion  */
+	uint32_t          accmax;         /* Max. latencies (hwtimer ticks)       */
+	uint32_t          cmpmax;
+	uint32_t          nocmp;          /* # completions not recorded (no tag)  */
+} UdpLatHistRec, *UdpLatHist;
+
 /* UDP socket struct                                                          */
 typedef struct UdpSockRec_ {
 	IpBscIf			  intrf;          /* IF this socket is using              */ 
@@ -423,13 +784,40 @@ typedef struct UdpSockRec_ {
 	rtems_id		  mutx;           /* Mutex for socket access              */
 	unsigned          flags;          /* Flags                                */
 	LanUdpPktRec      hdr;            /* A packet header for 'sendto'         */
+	uint32_t          hcsum;          /* 'hdr' IP csum partial (w/o len, csum */
+	                                  /* and dst; see ipHdrCsumPartial())     */
+	uint32_t          arpgen;         /* IF 'arpgen' when the MAC in 'hdr' was*/
+	                                  /* looked up (connected socket)         */
 	volatile unsigned nbytes;         /* # bytes queued (FIONREAD support)    */
 	int               mclpbk;         /* Loop-back MC packets sent from here  */
+	int               txprio;         /* TX priority class (0 is highest)     */
+	int               txtmo;          /* Wait for TX queue room (ticks)       */
+	uint32_t          pcrate;         /* Pacing rate (bytes/s; 0: no pacing)  */
+	uint32_t          pcburst;        /* Pacing bucket depth (bytes)          */
+	int64_t           pctokens;       /* Bucket contents (bytes * hwtmr_hz)   */
+	uint32_t          pchwt;          /* hwtimer at last refill               */
+	rtems_interval    pctck;          /* Clock tick at last refill            */
+	uint32_t          pcdelayed;      /* # sends delayed by pacing            */
+	uint32_t          pcmaxdly;       /* Max. pacing delay (us)               */
+	uint64_t          pcsumdly;       /* Accumulated pacing delay (us)        */
+	rtems_id          txsq;           /* TX status queue (tagged sends)       */
+	unsigned          gen;            /* Bumped when the socket is destroyed  */
+	UdpLatHistRec     lat;            /* TX latencies (if FLG_LATHIST)        */
+#if UDP_DSTCACHE_SZ > 0
+	uint32_t          dcclock;        /* LRU 'clock' of the dest. cache       */
+	UdpDstCacheRec    dcache[UDP_DSTCACHE_SZ]; /* Cache for 'sendto'         */
+#endif
 } UdpSockRec, *UdpSock;
 
 /* Flag to indicate that a socket is 'connected' (has a fixed peer)           */
 #define FLG_ISCONN	(1<<0)
 #define FLG_MCPASS  (1<<1)
+/* Flag to indicate that a socket sends/accepts fragmented datagrams          */
+#define FLG_FRAG    (1<<2)
+/* Flag to indicate that TX latencies are recorded                            */
+#define FLG_LATHIST (1<<3)
+/* Flag to indicate that senders don't wait for ARP replies                   */
+#define FLG_ARPNOWAIT (1<<4)
 
 /* Macros to lock/unlock a socket's mutex                                     */
 #define SOCKLOCK(sck)		mutex_lock((sck)->mutx)
@@ -466,11 +854,17 @@ static int    ravail        = NRBUFS;
 #endif
 static LanIpBscConfigRec lanIpBscCfg = {
 	mask:              LANIPCFG_RX_RING | LANIPCFG_TX_RING |
-                       LANIPCFG_N_RBUFS | LANIPCFG_SQDEPTH,
+                       LANIPCFG_N_RBUFS | LANIPCFG_SQDEPTH |
+                       LANIPCFG_ARPCSZ  | LANIPCFG_ARPNSEM |
+                       LANIPCFG_GARP,
 	rx_ring_size:      RX_RING_SIZE,
 	tx_ring_size:      TX_RING_SIZE,	
 	num_rbufs:         NRBUFS,
 	rx_queue_depth:    QDEPTH,	
+	arp_cache_size:    ARP_CACHESZ,
+	arp_nsems:         ARP_NSEMS,
+	arp_garp_count:    ARP_GARP_COUNT,
+	arp_garp_ival:     ARP_GARP_IVAL,
 };
 
 /* Counters for available and total number of rbufs                           */
@@ -501,11 +895,21 @@ static IpBscIf		intrf         = 0;
 /* Keep an available entry around                                             */
 static ArpEntry	arpScratch        = 0;
 
+/* Pool of ARP sync semaphores (see arp_sem_get())                            */
+static rtems_id *arpSemPool       = 0;
+static unsigned  arpSemAvail      = 0;
+static unsigned  arpSemSize       = 0;
+
 /* If this flag is set then for every accepted packet we save or refresh the
  * sender's address in the ARP cache.
  */
 int lanIpBscAutoRefreshARP        = 1;
 
+/* ... unless the entry holds the same MAC and was stored less than this many
+ * ticks ago (0: refresh for every packet).
+ */
+rtems_interval lanIpBscAutoRefreshARPTicks = ARP_REFRESH_TICKS;
+
 /**** FUNCTION FORWARD DECLARATIONS *******************************************/
 
 static inline void
@@ -527,7 +931,7 @@ static rtems_id
 lanIpCallout_initialize();
 
 static int
-addmca(IpBscIf pif, int sd, uint32_t mcaddr);
+addmca(IpBscIf pif, int sd, uint32_t mcaddr, McSrcFilt sf);
 
 static IpBscMcAddr
 delmca(IpBscIf pif, IpBscMcAddr mca, int sd);
@@ -700,11 +1104,28 @@ uint32_t tmp;
 	memcpy( enaddr + 2, &tmp , 4);
 }
 
-/* Check if 'ipaddr' is a multicast address to which 'pif' is subscribed      */
+/* Prefilter bit (index) of multicast group 'ipaddr' (low bits of address)    */
+static inline unsigned
+mcprefbit(uint32_t ipaddr)
+{
+	return ntohl( ipaddr ) & (MC_PREFILT_BITS - 1);
+}
+
+static inline int
+mcprefmaybe(IpBscIf pif, uint32_t ipaddr)
+{
+unsigned b = mcprefbit( ipaddr );
+	return 0 != ( pif->mcpref[b >> 5] & (1u << (b & 31)) );
+}
+
+/* Check if 'ipaddr' is a multicast address to which 'pif' is subscribed;
+ * the prefilter rejects most groups we are not interested in w/o looking
+ * into the hash table.
+ */
 static inline int
 mcListener(IpBscIf pif, uint32_t ipaddr)
 {
-	return ISMCST( ipaddr ) && lhtblFind( pif->mctable, ipaddr );
+	return ISMCST( ipaddr ) && mcprefmaybe( pif, ipaddr ) && lhtblFind( pif->mctable, ipaddr );
 }
 
 static inline IpBscMcAddr
@@ -1610,23 +2031,32 @@ rtems_interrupt_level key;
 	rtems_interrupt_enable(key);
 
 	rval->buf.intrf = 0;
+	rval->buf.txtag = 0;
+	rval->buf.frag  = 0;
 
 	return rval;
 }
 
-/* Decrement reference count and when it drops to 0 release buffer to pool    */
+/* Decrement reference count and when it drops to 0 release buffer to pool;
+ * the fragments chained to a reassembled datagram are released along with it.
+ */
 static void relrbuf(rbuf_t *b)
 {
 rtems_interrupt_level key;
+rbuf_t                *f;
 
-	if ( b ) {
+	while ( b ) {
+		f = 0;
 		rtems_interrupt_disable(key);
 			if ( 0 == --b->buf.refcnt ) {
+				f            = b->buf.frag;
+				b->buf.frag  = 0;
 				b->buf.next  = frb;
 				frb = b;
 				lanIpBufAvail++;
 			}
 		rtems_interrupt_enable(key);
+		b = f;
 	}
 }
 
@@ -1766,6 +2196,373 @@ rbuf_t                *rval;
 	return rval;
 }
 
+/**** STRICT-PRIORITY TX QUEUES **********************************************/
+
+static inline void
+txstatus_rbuf(IpBscIf pif, rbuf_t *b, int err);
+
+/* Drivers supporting TX priority classes provide NETDRV_TRY_ENQ_BUFFER() which
+ * -- unlike NETDRV_ENQ_BUFFER() -- does not consume the buffer but returns a
+ * value <= 0 if there is currently no room in the TX ring or FIFO.
+ * Such a driver must call txprio_drain() whenever room becomes available
+ * (i.e., after TX descriptors were swiped or TX status was reported).
+ * A driver may in addition provide NETDRV_TX_WAKEUP() which requests
+ * a (one-shot) txprio_drain() call once room becomes available; this is
+ * executed whenever the queues could not be drained completely.
+ * W/o driver support all packets are simply sent in FIFO order.
+ */
+#ifdef NETDRV_TRY_ENQ_BUFFER
+
+/* Is any packet held back?                                                   */
+#define TXPRIO_IDLE(pif)	(0 == (pif)->txqpend)
+/* Does a NETDRV_SND_PACKET() status indicate the packet must be queued?      */
+#define TXPRIO_ENQ(st)		(-ENOSPC == (st))
+
+/* Pass held-back packets to the driver in strict priority order until the
+ * driver runs out of room. Caller must hold the 'txmutx'.
+ */
+static void
+txprio_drain_locked(IpBscIf pif)
+{
+int      i;
+TxPrioQ  q;
+rbuf_t   *b, *nxt;
+uint32_t dly;
+unsigned pend = pif->txqpend;
+
+	for ( i=0; i<TXPRIO_NCLASSES; i++ ) {
+		q = &pif->txq[i];
+		while ( (b = q->head) ) {
+			/* Once handed over, the driver may release the buffer
+			 * at any time; read everything we need beforehand.
+			 */
+			nxt = b->buf.next;
+			dly = Read_hwtimer() - b->buf.txstmp;
+			if ( NETDRV_TRY_ENQ_BUFFER(pif, b, b->buf.txlen) <= 0 ) {
+				/* no room; lower classes must wait, too */
+#ifdef NETDRV_TX_WAKEUP
+				NETDRV_TX_WAKEUP(pif);
+#endif
+				goto done;
+			}
+			if ( ! (q->head = nxt) )
+				q->tail = 0;
+			q->nbufs--;
+			pif->txqpend--;
+			q->txfrm++;
+			q->sumdly += dly;
+			if ( dly > q->maxdly )
+				q->maxdly = dly;
+		}
+	}
+
+done:
+	if ( pif->txwaiters && pif->txqpend != pend ) {
+		/* Wake all blocked senders; the release covers a sender
+		 * that has not made it into rtems_semaphore_obtain() yet.
+		 */
+		rtems_semaphore_flush( pif->txwsem );
+		rtems_semaphore_release( pif->txwsem );
+	}
+}
+
+/* Called by the driver when room for more packets becomes available          */
+static void
+txprio_drain(IpBscIf pif)
+{
+	/* Unprotected test is OK; a sender queueing a packet increments
+	 * 'txqpend' and then attempts to drain itself (holding the mutex).
+	 */
+	if ( TXPRIO_IDLE(pif) )
+		return;
+	mutex_lock(pif->txmutx);
+		txprio_drain_locked(pif);
+	mutex_unlk(pif->txmutx);
+}
+
+/* Send a frame in priority class 'prio'. The frame is queued behind all
+ * held-back packets of the same or higher priority and all queues are then
+ * drained as far as the driver has room.
+ * If the class' queue is full then the caller waits up to 'tmo' ticks
+ * for room (0: don't wait, < 0: wait forever).
+ *
+ * RETURNS: 'len' if the frame was sent or queued, -ENOBUFS if the class'
+ *          queue is full (frame dropped). The buffer is consumed in any case.
+ */
+static int
+txprio_send(IpBscIf pif, int prio, rbuf_t *b, int len, int tmo)
+{
+TxPrioQ           q = &pif->txq[prio];
+int               rval;
+rtems_status_code sc;
+rtems_interval    deadline = 0, left = RTEMS_NO_TIMEOUT;
+
+	mutex_lock(pif->txmutx);
+
+	if ( q->nbufs >= TXPRIO_QDEPTH )
+		txprio_drain_locked(pif);
+
+	if ( q->nbufs >= TXPRIO_QDEPTH && tmo ) {
+		q->blocked++;
+		if ( tmo > 0 )
+			deadline = rtems_clock_get_ticks_since_boot() + tmo;
+		do {
+			/* wakeups don't restart the timeout; only wait for what is left */
+			if ( tmo > 0 ) {
+				if ( (int32_t)(left = deadline - rtems_clock_get_ticks_since_boot()) <= 0 )
+					break;
+			}
+			pif->txwaiters++;
+			mutex_unlk(pif->txmutx);
+			sc = rtems_semaphore_obtain( pif->txwsem, RTEMS_WAIT, left );
+			mutex_lock(pif->txmutx);
+			pif->txwaiters--;
+			/* RTEMS_UNSATISFIED means we were flushed, i.e., woken up */
+		} while ( q->nbufs >= TXPRIO_QDEPTH && RTEMS_TIMEOUT != sc );
+	}
+
+	if ( q->nbufs >= TXPRIO_QDEPTH ) {
+		q->dropped++;
+		relrbuf(b);
+		rval = -ENOBUFS;
+	} else {
+		b->buf.next   = 0;
+		b->buf.txlen  = len;
+		b->buf.txstmp = Read_hwtimer();
+		if ( q->tail )
+			q->tail->buf.next = b;
+		else
+			q->head           = b;
+		q->tail = b;
+		q->nbufs++;
+		pif->txqpend++;
+
+		txprio_drain_locked(pif);
+
+		/* Buffer cannot be re-queued while we hold the mutex; hence
+		 * it is still held back iff it is still at the tail.
+		 */
+		if ( q->tail == b )
+			q->held++;
+
+		rval = len;
+	}
+
+	mutex_unlk(pif->txmutx);
+
+	return rval;
+}
+
+/* Release all held-back packets (interface is going down)                    */
+static void
+txprio_flush(IpBscIf pif)
+{
+int     i;
+rbuf_t  *b;
+
+	for ( i=0; i<TXPRIO_NCLASSES; i++ ) {
+		while ( (b = pif->txq[i].head) ) {
+			pif->txq[i].head = b->buf.next;
+			txstatus_rbuf( pif, b, -ENETDOWN );
+			relrbuf(b);
+		}
+		pif->txq[i].tail  = 0;
+		pif->txq[i].nbufs = 0;
+	}
+	pif->txqpend = 0;
+	if ( pif->txwaiters )
+		rtems_semaphore_flush( pif->txwsem );
+}
+
+#else
+
+#define TXPRIO_IDLE(pif)	1
+#define TXPRIO_ENQ(st)		0
+
+#define txprio_flush(pif)	do { } while (0)
+
+#endif
+
+/**** TX STATUS REPORTING ****************************************************/
+
+/* Packets sent with udpSockSendTagged() or udpSockSendRegion() are assigned a
+ * 'tag' (1..TXSTS_NTAGS) which travels with the packet to the driver (in the
+ * rbuf's 'txtag' or as a NETDRV_SND_PACKET() argument). A driver which defines
+ * NETDRV_TX_STATUS calls txstatus_post() with the tag once the packet has been
+ * sent (or has failed) and a record is then posted to the sending socket's
+ * status queue (and/or a region slice is completed).
+ * For other drivers the status is posted when the packet is handed over and
+ * rbufs are passed with a zero 'txtag' -- except for the header buffer of a
+ * NETDRV_ENQ_BUFFER_REF() send which the driver reports on reclaim.
+ */
+
+/* Count a latency (hwtimer ticks) in a log2 histogram                         */
+static inline void
+lathist_add(uint32_t *bins, uint32_t *pmax, uint32_t dt)
+{
+int b;
+
+	if ( dt > *pmax )
+		*pmax = dt;
+	for ( b=0; dt && b < UDP_LATHIST_NBINS - 1; b++ )
+		dt >>= 1;
+	bins[b]++;
+}
+
+/* Allocate a tag for a packet sent from socket 'sd' from the 'n' tags
+ * starting at 'first'; '*pnxt' is where to start looking (relative to
+ * 'first').
+ *
+ * RETURNS: tag or 0 if all tags are in use.
+ */
+static unsigned
+txtag_alloc_pool(IpBscIf pif, unsigned first, unsigned n, unsigned *pnxt, int sd, uint32_t cookie, int len)
+{
+rtems_interrupt_level l;
+unsigned              i, j;
+TxTag                 t;
+
+	rtems_interrupt_disable(l);
+	for ( i=0, j=*pnxt; i<n; i++ ) {
+		t = &pif->txtags[first + j];
+		if ( ! t->inuse ) {
+			t->inuse = 1;
+			*pnxt    = ( j + 1 < n ) ? j + 1 : 0;
+			rtems_interrupt_enable(l);
+			t->sd     = sd;
+			t->sgen   = socks[sd].gen;
+			t->cookie = cookie;
+			t->len    = len;
+			t->lat    = 0;
+			t->nosts  = 0;
+			t->rgn    = 0;
+			return first + j + 1;
+		}
+		if ( ++j >= n )
+			j = 0;
+	}
+	rtems_interrupt_enable(l);
+	return 0;
+}
+
+static unsigned
+txtag_alloc(IpBscIf pif, int sd, uint32_t cookie, int len)
+{
+	return txtag_alloc_pool( pif, 0, TXSTS_NTAGS, &pif->txtagnxt, sd, cookie, len );
+}
+
+/* Tag for a packet whose completion is only needed for latency accounting */
+static unsigned
+txtag_alloc_lat(IpBscIf pif, int sd, int len)
+{
+unsigned tag;
+
+	if ( (tag = txtag_alloc_pool( pif, TXSTS_NTAGS, TXSTS_NLATTAGS, &pif->txlatnxt, sd, 0, len )) )
+		pif->txtags[tag - 1].nosts = 1;
+	return tag;
+}
+
+/* Release a tag w/o reporting (packet was never handed to the driver)        */
+static void
+txtag_free(IpBscIf pif, unsigned tag)
+{
+	if ( tag-- )
+		pif->txtags[tag].inuse = 0;
+}
+
+/* Tell the owner of a region that a slice is no longer referenced           */
+static void
+region_done(LanIpRegion rgn, void *ptr, int len, int status)
+{
+rtems_interrupt_level l;
+
+	rgn->done( rgn, ptr, len, status, rgn->closure );
+
+	rtems_interrupt_disable(l);
+		rgn->inflight--;
+	rtems_interrupt_enable(l);
+}
+
+/* Report the outcome ('err' == 0 or -errno) of the packet tagged 'tag' to the
+ * sending socket and release the tag. Nothing is done if 'tag' is 0.
+ * If the sending socket has been destroyed in the meantime then the status
+ * is dropped (the slot may already have been reused by a new socket).
+ */
+static void
+txstatus_post(IpBscIf pif, unsigned tag, int err)
+{
+TxTag              t;
+UdpSockTxStatusRec r;
+rtems_id           q;
+rtems_status_code  sc;
+int                sd;
+unsigned           sgen;
+
+	if ( tag-- == 0 || tag >= TXSTS_NTAGS + TXSTS_NLATTAGS )
+		return;
+
+	t = &pif->txtags[tag];
+
+	/* the slice is released even if the socket is gone */
+	if ( t->rgn )
+		region_done( t->rgn, t->rptr, t->len, err ? err : t->len );
+
+	/* early check (rechecked before posting the status below) */
+	if ( t->sgen != socks[t->sd].gen ) {
+		t->inuse = 0;
+		pif->stats.udp_txstsdropped++;
+		return;
+	}
+
+	if ( t->lat ) {
+		UdpSock s = &socks[t->sd];
+		if ( (FLG_LATHIST & s->flags) )
+			lathist_add( s->lat.cmp, &s->lat.cmpmax, Read_hwtimer() - t->t0 );
+	}
+
+	if ( t->nosts ) {
+		t->inuse = 0;
+		return;
+	}
+
+	rtems_clock_get_uptime( &r.tstmp );
+	r.cookie = t->cookie;
+	r.status = err ? err : t->len;
+	sd       = t->sd;
+	sgen     = t->sgen;
+
+	t->inuse = 0;
+
+	if ( err )
+		pif->stats.udp_txstserr++;
+
+	/* The socket may be destroyed or its queue replaced (and deleted)
+	 * meanwhile; check the generation, pick up the queue and send w/o
+	 * letting another task in (sending never blocks).
+	 */
+	_Thread_Disable_dispatch();
+		if ( sgen == socks[sd].gen && (q = socks[sd].txsq) )
+			sc = rtems_message_queue_send( q, &r, sizeof(r) );
+		else
+			sc = RTEMS_INVALID_ID;
+	_Thread_Enable_dispatch();
+
+	if ( RTEMS_SUCCESSFUL == sc )
+		pif->stats.udp_txsts++;
+	else
+		pif->stats.udp_txstsdropped++;
+}
+
+/* Report status of a tagged rbuf; clears the buffer's tag                    */
+static inline void
+txstatus_rbuf(IpBscIf pif, rbuf_t *b, int err)
+{
+	if ( b->buf.txtag ) {
+		txstatus_post( pif, b->buf.txtag, err );
+		b->buf.txtag = 0;
+	}
+}
+
 /**** ARP CACHE ACCESS AND OTHER ARP RELATED CODE *****************************/
 
 /* A helper type for copying 'spa' and 'tpa' fields in an ARP
@@ -1835,17 +2632,97 @@ rtems_interval now,difft;
 }
 
 
-/* Allocate and free an arp cache entry                                       */
-static ArpEntry
-arp_allocentry()
+/* Outstanding lookups borrow a sync semaphore from a pool which is filled
+ * when the stack is initialized; only if the pool is exhausted a semaphore
+ * is created (and deleted when it is returned to a full pool).
+ * A returned semaphore is flushed so that no waiter remains blocked
+ * on a recycled object (waiters see RTEMS_UNSATISFIED and look again).
+ * Nobody ever releases a sync semaphore, i.e., its count is always 0.
+ *
+ * The pool is protected by disabling interrupts.
+ */
+static rtems_id
+arp_sem_get(IpBscIf pif)
 {
-	return calloc(1, sizeof(ArpEntryRec));
-}
+rtems_interrupt_level l;
+rtems_id              id;
 
-static void
-arp_destroyentry(ArpEntry a)
-{
-	/* this is mostly called after executing arp_putscratch (from a 
+	rtems_interrupt_disable(l);
+	if ( arpSemAvail ) {
+		id = arpSemPool[--arpSemAvail];
+		rtems_interrupt_enable(l);
+		return id;
+	}
+	rtems_interrupt_enable(l);
+
+	if ( (id = bsem_create("arps", SEM_SYNC)) )
+		pif->stats.arp_semdyn++;
+
+	return id;
+}
+
+static void
+arp_sem_put(rtems_id id)
+{
+rtems_interrupt_level l;
+
+	rtems_semaphore_flush( id );
+
+	rtems_interrupt_disable(l);
+	if ( arpSemAvail < arpSemSize ) {
+		arpSemPool[arpSemAvail++] = id;
+		rtems_interrupt_enable(l);
+		return;
+	}
+	rtems_interrupt_enable(l);
+
+	rtems_semaphore_delete( id );
+}
+
+/* Preallocate 'n' semaphores                                                 */
+static int
+arp_sem_pool_create(unsigned n)
+{
+rtems_id id;
+
+	if ( ! n )
+		return 0;
+
+	if ( ! (arpSemPool = malloc( n * sizeof(*arpSemPool) )) )
+		return -ENOMEM;
+
+	arpSemSize = n;
+
+	while ( arpSemAvail < n ) {
+		if ( ! (id = bsem_create("arps", SEM_SYNC)) )
+			return -ENOSPC;
+		arpSemPool[arpSemAvail++] = id;
+	}
+
+	return 0;
+}
+
+static void
+arp_sem_pool_destroy()
+{
+	while ( arpSemAvail )
+		rtems_semaphore_delete( arpSemPool[--arpSemAvail] );
+	free( arpSemPool );
+	arpSemPool = 0;
+	arpSemSize = 0;
+}
+
+/* Allocate and free an arp cache entry                                       */
+static ArpEntry
+arp_allocentry()
+{
+	return calloc(1, sizeof(ArpEntryRec));
+}
+
+static void
+arp_destroyentry(ArpEntry a)
+{
+	/* this is mostly called after executing arp_putscratch (from a 
 	 * protected area) so there would be no need to try the semaphore
 	 * again -- however, e.g., when flushing the cache this routine
 	 * is also called and then deleting the semaphore might be
@@ -1853,7 +2730,7 @@ arp_destroyentry(ArpEntry a)
 	 */
 	if ( a ) {
 		if ( a->sync_resp )
-			rtems_semaphore_delete(a->sync_resp);
+			arp_sem_put(a->sync_resp);
 		free( a );
 	}
 }
@@ -1864,7 +2741,7 @@ arp_putscratch(ArpEntry e)
 {
 	if ( e ) {
 		if ( e->sync_resp ) {
-			rtems_semaphore_delete(e->sync_resp);
+			arp_sem_put(e->sync_resp);
 			e->sync_resp = 0;
 		}
 		if ( !arpScratch ) {
@@ -1899,10 +2776,13 @@ arp_putscratch(ArpEntry e)
 static ArpEntry
 arp_find_or_add(IpBscIf pif, ArpHash h, uint32_t ipaddr, ArpEntry *p_newe)
 {
-int         i, oh, empty;
-ArpEntry    found;
+int            i, oh, empty;
+ArpEntry       found;
+rtems_interval now, age, oldest;
+
+	now = rtems_clock_get_ticks_since_boot();
 
-	for ( i=0, oh = ARP_SENTINEL, empty=-1; i<CACHE_OVERLAP; i++, h++ ) {
+	for ( i=0, oh = -1, empty=-1, oldest = 0; i<CACHE_OVERLAP; i++, h = ARPNEXT(pif, h) ) {
 		if ( ! (found = arpcache(pif)[h]) ) {
 			if ( empty < 0 )
 				empty=h;
@@ -1911,25 +2791,27 @@ ArpEntry    found;
 		if ( ipaddr == found->ipaddr ) {
 			return found;
 		}
-		/* permanent entries are always 'newest' (ctime in the future)
-		 * hence the first non-permanent entry will be found
-		 * by this algorithm.
-		 */
-		if ( (uint32_t)found->ctime < (uint32_t)arpcache(pif)[oh]->ctime ) {
+		/* permanent entries are never evicted                    */
+		if ( ARP_PERM == found->ctime )
+			continue;
+		age = now - pif->arpatime[h];
+		if ( oh < 0 || age > oldest ) {
 			oh     = h;
+			oldest = age;
 		}
 	}
 
 	if ( empty<0 ) {
-		found = arpcache(pif)[oh];
-		/* all slots full; must evict oldest entry;
-		 * we also bail if 'oh' still points to ARP_SENTINEL.
-		 */
-		if ( found->ctime == ARP_PERM ) {
+		/* all slots full; must evict least-recently used entry  */
+		if ( oh < 0 ) {
 			/* ERROR CONDITION */
+			pif->stats.arp_nospc++;
 			fprintf(stderr,"arpPutEntry/arpLookup: too many permanent entries, unable to allocate slot\n");
+			/* 'found' is the last (permanent) entry we looked at */
 			return found;
 		}
+		found = arpcache(pif)[oh];
+		pif->stats.arp_evicted++;
 #ifdef DEBUG
 		if ( lanIpDebug & DEBUG_ARP ) {
 			printf("arpPutEntry/arpLookup no more slots, evicting #%i: ", oh);
@@ -1937,8 +2819,11 @@ ArpEntry    found;
 		}
 #endif
 		if ( found->sync_resp ) {
-			rtems_semaphore_delete( found->sync_resp );
+			arp_sem_put( found->sync_resp );
 			found->sync_resp = 0;
+		} else {
+			/* evicting a valid mapping */
+			pif->arpgen++;
 		}
 		found->ipaddr = 0;
 		h = oh;
@@ -1947,6 +2832,7 @@ ArpEntry    found;
 		found       = arpcache(pif)[h] = *p_newe;
 		*p_newe     = 0;
 	}
+	pif->arpatime[h] = now;
 	return found;
 }
 
@@ -1966,7 +2852,7 @@ ArpEntry rval;
 int      i;
 
 	ARPLOCK(pif);
-	for ( i = 0; i<CACHE_OVERLAP; i++, h++ ) {
+	for ( i = 0; i<CACHE_OVERLAP; i++, h = ARPNEXT(pif, h) ) {
 		if ( !(rval = arpcache(pif)[h]) )
 			continue;
 		if ( ipaddr == rval->ipaddr ) {
@@ -1982,6 +2868,7 @@ int      i;
 				ARPUNLOCK(pif);
 				return 0;
 			}
+			arp_wopen(pif, h, 1);
 #ifdef DEBUG
 			if ( (lanIpDebug & DEBUG_ARP) ) {
 				printf("arpLookup(): deleting placeholder entry #%i\n",h);
@@ -1990,6 +2877,7 @@ int      i;
 #endif
 			/* Still no reply */
 			arpcache(pif)[h] = 0;
+			arp_wclose(pif, h, 1);
 			found = rval;
 			break;
 		}
@@ -2109,7 +2997,7 @@ rtems_interval    now;
 			return SOME_ERROR_STATUS;
 #endif
 
-		h = ARPHASH(ipaddr);
+		h = ARPHASH(pif, ipaddr);
 
 		ARPLOCK(pif);
 		if ( !(newe = arpScratch) ) {
@@ -2121,6 +3009,8 @@ rtems_interval    now;
 			arpScratch = 0;
 		}
 
+		arp_wopen(pif, h, CACHE_OVERLAP);
+
 		rval = arp_find_or_add(pif, h, ipaddr, &newe);
 
 		if ( ipaddr == rval->ipaddr ) {
@@ -2168,12 +3058,12 @@ rtems_interval    now;
 				err = -ENOSPC;
 				goto egress;
 			}
-			rval->sync_resp = bsem_create("arps", SEM_SYNC);
+			rval->sync_resp = arp_sem_get(pif);
 			if ( !rval->sync_resp ) {
 				fprintf(stderr,"arpCreateSyncsem(): unable to create semaphore; delaying\n");
 				/* must find hash and remove from table */
 				assert( newe == 0 );
-				for ( i = 0; i<CACHE_OVERLAP; i++, h++ ) {
+				for ( i = 0; i<CACHE_OVERLAP; i++, h = ARPNEXT(pif, h) ) {
 					if ( !(rval = arpcache(pif)[h]) )
 						continue;
 					if ( ipaddr == rval->ipaddr ) {
@@ -2199,6 +3089,7 @@ rtems_interval    now;
 		}
 
 egress:
+		arp_wclose(pif, ARPHASH(pif, ipaddr), CACHE_OVERLAP);
 		newe = arp_putscratch(newe);
 		ARPUNLOCK(pif);
 		arp_destroyentry(newe);
@@ -2228,7 +3119,7 @@ rtems_status_code sc;
 			return SOME_ERROR_STATUS;
 #endif
 
-		h = ARPHASH(ipaddr);
+		h = ARPHASH(pif, ipaddr);
 
 		ARPLOCK(pif);
 		if ( !(newe = arpScratch) ) {
@@ -2273,12 +3164,12 @@ rtems_status_code sc;
 				sc = RTEMS_NO_MEMORY;
 				goto egress;
 			}
-			rval->sync_resp = bsem_create("arps", SEM_SYNC);
+			rval->sync_resp = arp_sem_get(pif);
 			if ( !rval->sync_resp ) {
 				fprintf(stderr,"arpAwaitReply: unable to create semaphore; not waiting\n");
 				/* must find hash and remove from table */
 				assert( newe == 0 );
-				for ( i = 0; i<CACHE_OVERLAP; i++, h++ ) {
+				for ( i = 0; i<CACHE_OVERLAP; i++, h = ARPNEXT(pif, h) ) {
 					if ( !(rval = arpcache(pif)[h]) )
 						continue;
 					if ( ipaddr == rval->ipaddr ) {
@@ -2327,6 +3218,71 @@ egress:
 }
 #endif
 
+/* Lock-free lookup of a valid entry (see arp_wopen()).
+ *
+ * RETURNS: 0 if a valid entry was found and its MAC address copied to
+ *          '*enaddr', nonzero if the caller must do a locked lookup.
+ */
+static int
+arp_find_fast(IpBscIf pif, ArpHash h, uint32_t ipaddr, uint8_t *enaddr)
+{
+int      i;
+uint32_t seq;
+ArpEntry e;
+uint8_t  mac[6];
+
+	for ( i = 0; i<CACHE_OVERLAP; i++, h = ARPNEXT(pif, h) ) {
+		seq = pif->arpseq[h];
+		if ( (seq & 1) )
+			return -1;
+		ARP_BARRIER();
+		if ( ! (e = arpcache(pif)[h]) || ipaddr != e->ipaddr )
+			continue;
+		if ( e->sync_resp )
+			return -1;
+		memcpy(mac, e->data.hwaddr, 6);
+		ARP_BARRIER();
+		if ( seq != pif->arpseq[h] )
+			return -1;
+		memcpy(enaddr, mac, 6);
+		pif->arpatime[h] = rtems_clock_get_ticks_since_boot();
+		return 0;
+	}
+	return -1;
+}
+
+/* Lock-free check if the entry for 'ipaddr' holds 'enaddr' and was stored less
+ * than 'ival' ticks before 'now' (permanent entries never need a refresh).
+ *
+ * RETURNS: 0 if the entry is fresh, nonzero if it should be refreshed (or
+ *          the caller can't tell).
+ */
+static int
+arp_find_fresh(IpBscIf pif, uint32_t ipaddr, const uint8_t *enaddr, rtems_interval now, rtems_interval ival)
+{
+ArpHash  h = ARPHASH(pif, ipaddr);
+int      i, rval;
+uint32_t seq;
+ArpEntry e;
+
+	for ( i = 0; i<CACHE_OVERLAP; i++, h = ARPNEXT(pif, h) ) {
+		seq = pif->arpseq[h];
+		if ( (seq & 1) )
+			return -1;
+		ARP_BARRIER();
+		if ( ! (e = arpcache(pif)[h]) || ipaddr != e->ipaddr )
+			continue;
+		if ( e->sync_resp || memcmp(e->data.hwaddr, enaddr, 6) )
+			return -1;
+		rval = ( ARP_PERM == e->ctime || now - e->rtime < ival ) ? 0 : -1;
+		ARP_BARRIER();
+		if ( seq != pif->arpseq[h] )
+			return -1;
+		return rval;
+	}
+	return -1;
+}
+
 /* Lookup 'ipaddr' in the ARP cache and store associated MAC addr. in '*enaddr'.
  *
  * If the 'cacheonly' argument is nonzero then the routine fails if no valid
@@ -2390,7 +3346,15 @@ int               err = -ENOTCONN;
 		}
 
 
-		h = ARPHASH(ipaddr);
+		h = ARPHASH(pif, ipaddr);
+
+		/* Cache hits don't need the lock                                */
+		if ( 0 == arp_find_fast(pif, h, ipaddr, enaddr) ) {
+			pif->stats.arp_lkfast++;
+			return 0;
+		}
+
+		pif->stats.arp_lklocked++;
 
 		attempts = 0;
 
@@ -2401,7 +3365,7 @@ int               err = -ENOTCONN;
 		while ( attempts < ARP_SEND_RETRY + 1 ) {
 
 			ARPLOCK(pif);
-			for ( i = 0, hh=h; i<CACHE_OVERLAP; i++, hh++ ) {
+			for ( i = 0, hh=h; i<CACHE_OVERLAP; i++, hh = ARPNEXT(pif, hh) ) {
 
 				if ( !(rval = arpcache(pif)[hh]) )
 					continue;
@@ -2410,6 +3374,7 @@ int               err = -ENOTCONN;
 					if ( ! rval->sync_resp ) {
 						/* Done, found valid cache entry */
 						memcpy(enaddr, rval->data.hwaddr, 6);
+						pif->arpatime[hh] = rtems_clock_get_ticks_since_boot();
 						ARPUNLOCK(pif);
 						return 0;
 					} else {
@@ -2483,44 +3448,215 @@ try_again:
 		return err;
 }
 
-/* Store an IPv4 / MAC address pair in the ARP cache. If the 'perm' argument
- * is nonzero then the entry is marked 'permanent' or 'static' which means
- * that it is never evicted from the cache.
- * Cache entries may be evicted (if they are not 'permanent') if space is needed
- * for a new entry or (if the 'arpScavenger' is run in the background) if an
- * entry becomes too old (no lookup or auto-update has been done for some
- * 'max-age' time).
+/* Non-blocking senders (FLG_ARPNOWAIT) park a complete frame (all headers but
+ * the destination MAC filled in) on the IF's hold queue if the destination is
+ * not in the ARP cache. Held frames are sent when the reply arrives (the
+ * lpWorker task executes arpPutEntry()) or dropped once the request
+ * was repeated ARP_SEND_RETRY times w/o reply.
+ * The hold queue is short and protected by disabling thread dispatching.
+ */
+
+/* Hand a held frame to the driver                                            */
+static void
+arpHoldXmit(IpBscIf pif, rbuf_t *b, const uint8_t *enaddr)
+{
+unsigned tag = b->buf.txtag;
+int      len = b->buf.txlen;
+int      rval;
+
+	memcpy( lpkt_eth( &b->pkt ).dst, enaddr, 6 );
+	b->buf.next = 0;
+#ifndef NETDRV_TX_STATUS
+	/* status is posted here; the driver must not see the tag */
+	b->buf.txtag = 0;
+#endif
+#ifdef NETDRV_TRY_ENQ_BUFFER
+	rval = txprio_send( pif, b->buf.txprio, b, len, 0 );
+#else
+	rval = len;
+	NETDRV_ENQ_BUFFER( pif, b, len );
+#endif
+	if ( rval > 0 ) {
+		pif->stats.arp_holdsent++;
+		pif->stats.udp_txfrm++;
+		pif->stats.udp_txbytes += len - sizeof(LanUdpPktRec);
+#ifndef NETDRV_TX_STATUS
+		txstatus_post( pif, tag, 0 );
+#endif
+	} else {
+		txtag_free( pif, tag );
+		pif->stats.udp_txdropped++;
+	}
+}
+
+/* Send all frames held for 'ipaddr' (which now resolves to 'enaddr')         */
+static void
+arpHoldRelease(IpBscIf pif, uint32_t ipaddr, const uint8_t *enaddr)
+{
+rbuf_t *b, **pp, *rel = 0, **tp = &rel;
+
+	/* unprotected test is OK; we'll look again */
+	if ( ! pif->arphold )
+		return;
+
+	_Thread_Disable_dispatch();
+		for ( pp = &pif->arphold; (b = *pp); ) {
+			if ( ipaddr == lpkt_ip( &b->pkt ).dst ) {
+				*pp = b->buf.next;
+				*tp = b;
+				tp  = &b->buf.next;
+				pif->arpnhold--;
+			} else {
+				pp  = &b->buf.next;
+			}
+		}
+		*tp = 0;
+	_Thread_Enable_dispatch();
+
+	/* preserve order */
+	while ( (b = rel) ) {
+		rel = b->buf.next;
+		arpHoldXmit( pif, b, enaddr );
+	}
+}
+
+/* Callout: repeat requests for held frames and drop expired ones             */
+static void
+arpHoldTimer(void *arg0, void *arg1)
+{
+IpBscIf        pif  = arg0;
+rbuf_t         *b, **pp, *drop = 0;
+uint32_t       dst[ARP_HOLD_MAX];
+int            i, n = 0;
+rtems_interval now  = rtems_clock_get_ticks_since_boot();
+
+	_Thread_Disable_dispatch();
+		for ( pp = &pif->arphold; (b = *pp); ) {
+			if ( now - b->buf.txstmp >= ARP_HOLD_PERIOD * ARP_SEND_RETRY ) {
+				*pp         = b->buf.next;
+				b->buf.next = drop;
+				drop        = b;
+				pif->arpnhold--;
+				continue;
+			}
+			pp = &b->buf.next;
+			for ( i=0; i<n && dst[i] != lpkt_ip( &b->pkt ).dst; i++ )
+				/* nothing else to do */;
+			if ( i == n && n < ARP_HOLD_MAX )
+				dst[n++] = lpkt_ip( &b->pkt ).dst;
+		}
+		lanIpCallout_deactivate( &pif->arpholdco );
+		if ( pif->arphold )
+			lanIpCallout_reset( &pif->arpholdco, ARP_HOLD_PERIOD, arpHoldTimer, pif, 0 );
+	_Thread_Enable_dispatch();
+
+	for ( i=0; i<n; i++ ) {
+		pif->stats.arp_txreq++;
+		NETDRV_ATOMIC_SEND_ARPREQ(pif, dst[i]);
+	}
+
+	while ( (b = drop) ) {
+		drop        = b->buf.next;
+		b->buf.next = 0;
+		pif->stats.arp_holdtimo++;
+		txstatus_rbuf( pif, b, -EHOSTUNREACH );
+		relrbuf( b );
+	}
+}
+
+/* Park frame 'b' (total length 'len') for 'ipaddr' which was not found in the
+ * ARP cache and send an ARP request if this is the first frame held for this
+ * destination. 'prio' is the TX priority class to use once resolved.
+ *
+ * RETURNS: 0 if the frame was parked (it is consumed), -ENOBUFS if the hold
+ *          queue is full (the caller still owns the frame).
+ */
+static int
+arpHoldPkt(IpBscIf pif, uint32_t ipaddr, rbuf_t *b, int len, int prio)
+{
+rbuf_t   *p, **pp;
+unsigned n;
+uint8_t  enaddr[6];
+
+	b->buf.next   = 0;
+	b->buf.txlen  = len;
+	b->buf.txprio = prio;
+	b->buf.txstmp = rtems_clock_get_ticks_since_boot();
+
+	_Thread_Disable_dispatch();
+		for ( n = 0, pp = &pif->arphold; (p = *pp); pp = &p->buf.next ) {
+			if ( ipaddr == lpkt_ip( &p->pkt ).dst )
+				n++;
+		}
+		if ( n >= ARP_HOLD_PERDST || pif->arpnhold >= ARP_HOLD_MAX ) {
+			_Thread_Enable_dispatch();
+			pif->stats.arp_holddropped++;
+			return -ENOBUFS;
+		}
+		*pp = b;
+		pif->arpnhold++;
+		if ( ! lanIpCallout_active( &pif->arpholdco ) )
+			lanIpCallout_reset( &pif->arpholdco, ARP_HOLD_PERIOD, arpHoldTimer, pif, 0 );
+	_Thread_Enable_dispatch();
+
+	pif->stats.arp_held++;
+
+	if ( 0 == n ) {
+		pif->stats.arp_txreq++;
+		NETDRV_ATOMIC_SEND_ARPREQ(pif, ipaddr);
+	}
+
+	/* The reply could have arrived before we parked the frame            */
+	if ( 0 == arpLookup( pif, ipaddr, enaddr, 1 ) )
+		arpHoldRelease( pif, ipaddr, enaddr );
+
+	return 0;
+}
+
+/* Drop all held frames (IF is going down)                                    */
+static void
+arpHoldFlush(IpBscIf pif)
+{
+rbuf_t *b;
+
+	lanIpCallout_stop( &pif->arpholdco );
+
+	_Thread_Disable_dispatch();
+		b             = pif->arphold;
+		pif->arphold  = 0;
+		pif->arpnhold = 0;
+	_Thread_Enable_dispatch();
+
+	while ( b ) {
+		rbuf_t *nxt = b->buf.next;
+		b->buf.next = 0;
+		txstatus_rbuf( pif, b, -ENETDOWN );
+		relrbuf( b );
+		b = nxt;
+	}
+}
+
+/* Store an IPv4 / MAC address pair (see arpPutEntry()); the caller holds the
+ * ARP lock and supplies a new entry '*p_newe' (which is set to NULL if it
+ * was used).
  *
  * RETURNS: zero on success or '- errno' on failure.
  */
-int
-arpPutEntry(IpBscIf pif, uint32_t ipaddr, uint8_t *enaddr, int perm)
+static int
+arp_put_locked(IpBscIf pif, uint32_t ipaddr, const uint8_t *enaddr, int perm, ArpEntry *p_newe)
 {
 ArpEntry rval;
-ArpEntry newe;
 ArpHash  h;
 int      err = -ENOSPC;
 #ifdef DEBUG
 const char *dbgstr = 0;
 #endif
 
-		/* Silently ignore broadcast + multicast addresses */
-		if ( ISBCST( ipaddr, pif->nmask ) || ISMCST( ipaddr ) )
-			return 0;
-
-		h = ARPHASH(ipaddr);
+		h = ARPHASH(pif, ipaddr);
 
-		ARPLOCK(pif);
-		if ( !(newe = arpScratch) ) {
-			ARPUNLOCK(pif);
-			newe = arp_allocentry();
-			ARPLOCK(pif);
-		} else {
-			/* we took over the scratch entry */
-			arpScratch = 0;
-		}
+		arp_wopen(pif, h, CACHE_OVERLAP);
 
-		rval = arp_find_or_add(pif, h, ipaddr, &newe);
+		rval = arp_find_or_add(pif, h, ipaddr, p_newe);
 
 		if ( ipaddr == rval->ipaddr ) {
 #ifdef DEBUG
@@ -2529,11 +3665,13 @@ const char *dbgstr = 0;
 			}
 #endif
 
-			/* Notify waiting tasks */
+			/* Notify waiting tasks (flushed when returned to pool) */
 			if ( rval->sync_resp ) {
-				rtems_semaphore_flush( rval->sync_resp );
-				rtems_semaphore_delete( rval->sync_resp );
+				arp_sem_put( rval->sync_resp );
 				rval->sync_resp = 0;
+			} else if ( memcmp( rval->data.hwaddr, enaddr, 6 ) ) {
+				/* MAC address changed */
+				pif->arpgen++;
 			}
 
 			/* Done. Refresh entry and leave. */
@@ -2554,6 +3692,7 @@ const char *dbgstr = 0;
 		}
 
 		memcpy(rval->data.hwaddr, enaddr, 6);
+		rval->rtime = rtems_clock_get_ticks_since_boot();
 
 		if ( perm > 0 ) {
 			rval->ctime = ARP_PERM;
@@ -2575,77 +3714,376 @@ const char *dbgstr = 0;
 		err = 0;
 
 egress:
-		newe = arp_putscratch( newe );
-		ARPUNLOCK(pif);
-		arp_destroyentry(newe);
+		arp_wclose(pif, h, CACHE_OVERLAP);
 
 		return err;
 }
 
-/* Remove 'ipaddr' from ARP cache.                                            */
-void
-arpDelEntry(IpBscIf pif, uint32_t ipaddr)
+/* Store an IPv4 / MAC address pair in the ARP cache. If the 'perm' argument
+ * is nonzero then the entry is marked 'permanent' or 'static' which means
+ * that it is never evicted from the cache.
+ * Cache entries may be evicted (if they are not 'permanent') if space is needed
+ * for a new entry or (if the 'arpScavenger' is run in the background) if an
+ * entry becomes too old (no lookup or auto-update has been done for some
+ * 'max-age' time).
+ *
+ * RETURNS: zero on success or '- errno' on failure.
+ */
+int
+arpPutEntry(IpBscIf pif, uint32_t ipaddr, uint8_t *enaddr, int perm)
 {
-ArpEntry rval, found = 0;
-int      i;
-ArpHash  h;
+ArpEntry newe;
+int      err;
 
-		h = ARPHASH(ipaddr);
+		/* Silently ignore broadcast + multicast addresses */
+		if ( ISBCST( ipaddr, pif->nmask ) || ISMCST( ipaddr ) )
+			return 0;
 
 		ARPLOCK(pif);
-		for ( i = 0; i<CACHE_OVERLAP; i++, h++ ) {
-				if ( !(rval = arpcache(pif)[h]) )
-					continue;
-				if ( ipaddr == rval->ipaddr ) {
-					arpcache(pif)[h] = 0;
-					found           = rval;
-					break;
-				}
+		if ( !(newe = arpScratch) ) {
+			ARPUNLOCK(pif);
+			newe = arp_allocentry();
+			ARPLOCK(pif);
+		} else {
+			/* we took over the scratch entry */
+			arpScratch = 0;
 		}
 
-		found = arp_putscratch( found );
+		err  = arp_put_locked(pif, ipaddr, enaddr, perm, &newe);
+
+		newe = arp_putscratch( newe );
 		ARPUNLOCK(pif);
-		arp_destroyentry(found);
+		arp_destroyentry(newe);
+
+		if ( 0 == err )
+			arpHoldRelease(pif, ipaddr, enaddr);
+
+		return err;
 }
 
-/* Unprotected version of 'arpFlushCache()' to be used when cleaning up after
- * interface object has been destroyed.
+/* Callout: send (broadcast) requests for loaded, non-permanent entries; a
+ * reply refreshes the entry (and updates it if the peer's MAC has changed).
+ * Requests are paced to avoid a burst at startup.
  */
 static void
-arpTearDown(IpBscIf pif, int perm_also)
+arpRevalTimer(void *arg0, void *arg1)
 {
-int i;
+IpBscIf  pif = arg0;
+uint32_t ips[ARP_REVAL_PERTICK];
+int      i, n;
 
-	for ( i=0; i<ARP_CACHESZ; i++ ) {
-		if ( perm_also || (arpcache(pif)[i] && ARP_PERM != arpcache(pif)[i]->ctime) ) {
-			arp_destroyentry(arpcache(pif)[i]);
-			arpcache(pif)[i] = 0;
+	ARPLOCK(pif);
+		for ( n = 0; n < ARP_REVAL_PERTICK && pif->arprevi < pif->arprevn; n++ )
+			ips[n] = pif->arprevl[pif->arprevi++];
+		if ( pif->arprevi >= pif->arprevn ) {
+			free( pif->arprevl );
+			pif->arprevl = 0;
+			pif->arprevn = pif->arprevi = 0;
 		}
-	}
+		lanIpCallout_deactivate( &pif->arprevco );
+		if ( pif->arprevl )
+			lanIpCallout_reset( &pif->arprevco, 1, arpRevalTimer, pif, 0 );
+	ARPUNLOCK(pif);
 
-	arp_destroyentry(arpScratch);
-	arpScratch = 0;
+	for ( i=0; i<n; i++ ) {
+		pif->stats.arp_txreq++;
+		pif->stats.arp_reval++;
+		NETDRV_ATOMIC_SEND_ARPREQ(pif, ips[i]);
+	}
 }
 
-/* Remove all entries from the ARP cache. Optionally ('perm_also' == 0) only
- * non-permanent entries are flushed/removed.
+/* Append 'n' addresses to the revalidation list (ARP lock held). 'l' holds
+ * the addresses, is taken over and must have room for the addresses still
+ * pending, too.
+ *
+ * RETURNS: list the caller must free() after releasing the ARP lock.
  */
-void
-arpFlushCache(IpBscIf pif, int perm_also)
+static uint32_t *
+arp_reval_add(IpBscIf pif, uint32_t *l, unsigned n)
 {
-	/* cleanup everything */
+uint32_t *nl;
+unsigned rem = pif->arprevn - pif->arprevi;
 
-	ARPLOCK(pif);
+	if ( ! n )
+		return l;
 
-	arpTearDown(pif, perm_also);
+	/* pending addresses go first */
+	memmove( l + rem, l,                           n   * sizeof(*l) );
+	memcpy ( l,       pif->arprevl + pif->arprevi, rem * sizeof(*l) );
 
-	ARPUNLOCK(pif);
-}
+	nl           = pif->arprevl;
+	pif->arprevl = l;
+	pif->arprevn = rem + n;
+	pif->arprevi = 0;
 
-/* Print info for all ARP cache entries to file 'f' (stdout is used if NULL)  */
+	if ( ! lanIpCallout_active( &pif->arprevco ) )
+		lanIpCallout_reset( &pif->arprevco, 1, arpRevalTimer, pif, 0 );
 
-static void
-arpDumpCacheIndented(int ind, IpBscIf pif, FILE *f)
+	return nl;
+}
+
+int
+arpLoad(IpBscIf pif, const LanIpArpEntryRec *ents, int n)
+{
+ArpEntry *pool, newe = 0;
+uint32_t *rl;
+unsigned nrl  = 0, rem;
+int      i, st, np, nok = 0, err = 0;
+uint8_t  mac[6];
+
+	if ( n <= 0 )
+		return 0;
+
+	/* Allocate everything beforehand so that all entries are stored
+	 * in a single pass holding the ARP lock.
+	 */
+	if ( ! (pool = malloc( n * sizeof(*pool) )) )
+		return -ENOMEM;
+
+	/* a short pool is OK; entries that are merely updated need none */
+	for ( np = 0; np < n && (pool[np] = arp_allocentry()); np++ )
+		;
+
+	/* room for our addresses and those pending revalidation; the
+	 * unprotected peek is verified once we hold the lock.
+	 */
+	while ( 1 ) {
+		rem = pif->arprevn - pif->arprevi;
+		if ( ! (rl = malloc( (rem + n) * sizeof(*rl) )) ) {
+			err = -ENOMEM;
+			goto bail;
+		}
+		ARPLOCK(pif);
+		if ( pif->arprevn - pif->arprevi <= rem )
+			break;
+		/* list grew meanwhile */
+		ARPUNLOCK(pif);
+		free( rl );
+	}
+
+	for ( i=0; i<n; i++ ) {
+		if (    ISBCST( ents[i].ipaddr, pif->nmask )
+		     || ISMCST( ents[i].ipaddr )
+		     || (ents[i].ipaddr & pif->nmask) != (pif->ipaddr & pif->nmask) ) {
+			err = -EINVAL;
+			continue;
+		}
+		if ( ! newe ) {
+			if ( np > 0 ) {
+				newe = pool[--np];
+			} else if ( (newe = arpScratch) ) {
+				arpScratch = 0;
+			} else {
+				err = -ENOMEM;
+				break;
+			}
+		}
+		if ( (st = arp_put_locked(pif, ents[i].ipaddr, ents[i].hwaddr, ents[i].perm ? 1 : 0, &newe)) ) {
+			err = st;
+			continue;
+		}
+		nok++;
+		if ( ! ents[i].perm )
+			rl[nrl++] = ents[i].ipaddr;
+	}
+	rl   = arp_reval_add(pif, rl, nrl);
+	newe = arp_putscratch( newe );
+	ARPUNLOCK(pif);
+	free( rl );
+	arp_destroyentry(newe);
+
+	pif->stats.arp_loaded += nok;
+
+	/* unlikely at startup but somebody might be waiting */
+	if ( pif->arphold ) {
+		for ( i=0; i<n; i++ ) {
+			if ( 0 == arpLookup( pif, ents[i].ipaddr, mac, 1 ) )
+				arpHoldRelease( pif, ents[i].ipaddr, mac );
+		}
+	}
+
+bail:
+	while ( np > 0 )
+		arp_destroyentry( pool[--np] );
+	free( pool );
+
+	return nok ? nok : err;
+}
+
+int
+arpSnapshot(IpBscIf pif, LanIpArpEntryRec *ents, int max)
+{
+int      i, n = 0;
+ArpEntry e;
+
+	ARPLOCK(pif);
+	for ( i=0; i<arpcachesz(pif) && n < max; i++ ) {
+		/* skip free slots and outstanding lookups */
+		if ( ! (e = arpcache(pif)[i]) || e->sync_resp )
+			continue;
+		ents[n].ipaddr = e->ipaddr;
+		memcpy( ents[n].hwaddr, e->data.hwaddr, 6 );
+		ents[n].perm   = ( ARP_PERM == e->ctime );
+		n++;
+	}
+	ARPUNLOCK(pif);
+
+	return n;
+}
+
+int
+arpLoadFile(IpBscIf pif, const char *fnam)
+{
+FILE             *f;
+char             line[128], ipstr[20];
+unsigned         m[6];
+int              nf, perm, lno = 0, n = 0, max = 0, j, rval;
+uint32_t         ipaddr;
+LanIpArpEntryRec *ents = 0, *ne;
+
+	if ( ! (f = fopen(fnam, "r")) )
+		return -errno;
+
+	while ( fgets(line, sizeof(line), f) ) {
+		lno++;
+		perm = 0;
+		nf   = sscanf(line, " %19s %x:%x:%x:%x:%x:%x %i", ipstr, &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &perm);
+		if ( nf <= 0 || '#' == ipstr[0] )
+			continue; /* blank or comment */
+		if ( nf < 7 || INADDR_NONE == (ipaddr = inet_addr(ipstr)) ) {
+			fprintf(stderr,"arpLoadFile(): %s:%i: syntax error (expected '<ip> <mac> [<perm>]')\n", fnam, lno);
+			continue;
+		}
+		if ( n >= max ) {
+			max = max ? 2*max : 32;
+			if ( ! (ne = realloc(ents, max * sizeof(*ents))) ) {
+				fclose(f);
+				free(ents);
+				return -ENOMEM;
+			}
+			ents = ne;
+		}
+		ents[n].ipaddr = ipaddr;
+		for ( j=0; j<6; j++ )
+			ents[n].hwaddr[j] = m[j];
+		ents[n].perm   = perm ? 1 : 0;
+		n++;
+	}
+	fclose(f);
+
+	rval = arpLoad(pif, ents, n);
+
+	free(ents);
+
+	return rval;
+}
+
+int
+arpSaveFile(IpBscIf pif, const char *fnam)
+{
+FILE             *f;
+char             ipbuf[4*4];
+int              i, n;
+LanIpArpEntryRec *ents;
+
+	if ( ! (ents = malloc( arpcachesz(pif) * sizeof(*ents) )) )
+		return -ENOMEM;
+
+	n = arpSnapshot(pif, ents, arpcachesz(pif));
+
+	if ( ! (f = fopen(fnam, "w")) ) {
+		free(ents);
+		return -errno;
+	}
+
+	fprintf(f,"# <ip> <mac> <permanent>\n");
+	for ( i=0; i<n; i++ ) {
+		lanIpBscNtop( ents[i].ipaddr, ipbuf, sizeof(ipbuf) );
+		fprintf(f,"%s %02x:%02x:%02x:%02x:%02x:%02x %i\n", ipbuf,
+			ents[i].hwaddr[0], ents[i].hwaddr[1], ents[i].hwaddr[2],
+			ents[i].hwaddr[3], ents[i].hwaddr[4], ents[i].hwaddr[5],
+			ents[i].perm);
+	}
+
+	free(ents);
+
+	if ( fclose(f) )
+		return -errno;
+
+	return n;
+}
+
+/* Remove 'ipaddr' from ARP cache.                                            */
+void
+arpDelEntry(IpBscIf pif, uint32_t ipaddr)
+{
+ArpEntry rval, found = 0;
+int      i;
+ArpHash  h;
+
+		h = ARPHASH(pif, ipaddr);
+
+		ARPLOCK(pif);
+		for ( i = 0; i<CACHE_OVERLAP; i++, h = ARPNEXT(pif, h) ) {
+				if ( !(rval = arpcache(pif)[h]) )
+					continue;
+				if ( ipaddr == rval->ipaddr ) {
+					arp_wopen(pif, h, 1);
+					arpcache(pif)[h] = 0;
+					arp_wclose(pif, h, 1);
+					found           = rval;
+					pif->arpgen++;
+					break;
+				}
+		}
+
+		found = arp_putscratch( found );
+		ARPUNLOCK(pif);
+		arp_destroyentry(found);
+}
+
+/* Unprotected version of 'arpFlushCache()' to be used when cleaning up after
+ * interface object has been destroyed.
+ */
+static void
+arpTearDown(IpBscIf pif, int perm_also)
+{
+int i;
+
+	arp_wopen(pif, 0, arpcachesz(pif));
+	for ( i=0; i<arpcachesz(pif); i++ ) {
+		if ( perm_also || (arpcache(pif)[i] && ARP_PERM != arpcache(pif)[i]->ctime) ) {
+			arp_destroyentry(arpcache(pif)[i]);
+			arpcache(pif)[i] = 0;
+		}
+	}
+	arp_wclose(pif, 0, arpcachesz(pif));
+
+	arp_destroyentry(arpScratch);
+	arpScratch = 0;
+
+	pif->arpgen++;
+}
+
+/* Remove all entries from the ARP cache. Optionally ('perm_also' == 0) only
+ * non-permanent entries are flushed/removed.
+ */
+void
+arpFlushCache(IpBscIf pif, int perm_also)
+{
+	/* cleanup everything */
+
+	ARPLOCK(pif);
+
+	arpTearDown(pif, perm_also);
+
+	ARPUNLOCK(pif);
+}
+
+/* Print info for all ARP cache entries to file 'f' (stdout is used if NULL)  */
+
+static void
+arpDumpCacheIndented(int ind, IpBscIf pif, FILE *f)
 {
 ArpEntryRec           abuf;
 int                   i;
@@ -2653,7 +4091,7 @@ int                   i;
 	if ( !f )
 		f = stdout;
 
-	for ( i=0; i<ARP_CACHESZ; i++ ) {
+	for ( i=0; i<arpcachesz(pif); i++ ) {
 		if ( (volatile ArpEntry) arpcache(pif)[i] ) {
 
 			ARPLOCK( pif );
@@ -2702,7 +4140,7 @@ ArpEntry              e;
 		rtems_clock_get(RTEMS_CLOCK_GET_SECONDS_SINCE_EPOCH, &now);
 		ancient = now - maxage;
 
-		for ( i=0; i<ARP_CACHESZ; i++ ) {
+		for ( i=0; i<arpcachesz(pif); i++ ) {
 			if ( ! (volatile ArpEntry) arpcache(pif)[i] ) 
 				continue;
 
@@ -2714,7 +4152,10 @@ ArpEntry              e;
 			}
 			if ( (uint32_t)e->ctime < (uint32_t)ancient ) {
 				/* evict */
+				arp_wopen(pif, i, 1);
 				arpcache(pif)[i] = 0;
+				arp_wclose(pif, i, 1);
+				pif->arpgen++;
 				e = arp_putscratch(e);
 
 #ifdef DEBUG
@@ -2759,7 +4200,188 @@ ArpEntry              e;
 	}
 }
 
-/**** IGMP V2 PROTOCOL IMPLEMENTATION *****************************************/
+/* Send a unicast ARP request for 'ipaddr' to 'enaddr' (the MAC address we
+ * already know) which refreshes the entry w/o bothering everybody else.
+ */
+static void
+arpSendProbe(IpBscIf pif, uint32_t ipaddr, const uint8_t *enaddr)
+{
+rbuf_t    *p;
+LanArpPkt pa;
+
+	if ( ! (p = getrbuf()) )
+		return;
+
+	pa = &lpkt_arp_pkt( &p->pkt );
+	memcpy( pa, &pif->arpreq, sizeof(*pa) );
+	memcpy( pa->ll.dst,  enaddr, 6 );
+	memcpy( pa->arp.tha, enaddr, 6 );
+	set_tpa( &pa->arp, ipaddr );
+
+	pif->stats.arp_txreq++;
+	pif->stats.arp_probes++;
+	NETDRV_ENQ_BUFFER( pif, p, sizeof(*pa) );
+}
+
+/* Callout: built-in aging (see arpSetAging()). Once per second a batch of
+ * slots is inspected so that the whole cache is swept twice during the
+ * probe window (or during 'maxage' if there is no probing).
+ */
+static void
+arpAgeTimer(void *arg0, void *arg1)
+{
+IpBscIf        pif    = arg0;
+uint32_t       maxage = pif->arpmaxage;
+uint32_t       probe  = pif->arpprobe;
+rtems_interval now, tps, age, span;
+int            i, n, batch;
+ArpEntry       e;
+uint32_t       ipaddr;
+uint8_t        mac[6];
+
+	rtems_clock_get(RTEMS_CLOCK_GET_SECONDS_SINCE_EPOCH, &now);
+	rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &tps);
+
+	if ( maxage ) {
+		span  = probe ? probe : maxage;
+		span  = span > 2 ? span/2 : 1;
+		batch = (arpcachesz(pif) + span - 1)/span;
+
+		for ( n = 0; n < batch; n++ ) {
+			i              = pif->arpagenxt;
+			pif->arpagenxt = ARPNEXT(pif, i);
+
+			if ( ! (volatile ArpEntry) arpcache(pif)[i] )
+				continue;
+
+			ARPLOCK( pif );
+			/* have to check again from within protected section */
+			e = arpcache(pif)[i];
+			if ( ! e || ARP_PERM == e->ctime || e->sync_resp ) {
+				/* nothing to do for permanent or unresolved entries */
+				ARPUNLOCK( pif );
+				continue;
+			}
+
+			age = now - e->ctime;
+
+			if ( age >= maxage ) {
+				/* expired; whoever still needs it must look it up again */
+				arp_wopen(pif, i, 1);
+				arpcache(pif)[i] = 0;
+				arp_wclose(pif, i, 1);
+				pif->arpgen++;
+				pif->stats.arp_aged++;
+				e = arp_putscratch(e);
+				ARPUNLOCK( pif );
+				arp_destroyentry(e);
+			} else if (    probe
+			            && age >= maxage - probe
+			            && rtems_clock_get_ticks_since_boot() - pif->arpatime[i] < probe * tps ) {
+				/* about to expire but in use; refresh in the background */
+				ipaddr = e->ipaddr;
+				memcpy( mac, e->data.hwaddr, 6 );
+				ARPUNLOCK( pif );
+				arpSendProbe( pif, ipaddr, mac );
+			} else {
+				ARPUNLOCK( pif );
+			}
+		}
+	}
+
+	_Thread_Disable_dispatch();
+		lanIpCallout_deactivate( &pif->arpageco );
+		if ( pif->arpmaxage )
+			lanIpCallout_reset( &pif->arpageco, tps, arpAgeTimer, pif, 0 );
+	_Thread_Enable_dispatch();
+}
+
+int
+arpSetAging(IpBscIf pif, uint32_t maxage, uint32_t probe)
+{
+rtems_interval tps;
+
+	if ( maxage && probe >= maxage )
+		return -EINVAL;
+
+	rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &tps);
+
+	_Thread_Disable_dispatch();
+		pif->arpmaxage = maxage;
+		pif->arpprobe  = probe;
+		/* if the callout is active it picks up the new settings */
+		if ( maxage && ! lanIpCallout_active( &pif->arpageco ) )
+			lanIpCallout_reset( &pif->arpageco, tps, arpAgeTimer, pif, 0 );
+	_Thread_Enable_dispatch();
+
+	return 0;
+}
+
+/* Send a gratuitous ARP (broadcast request for our own address) so that
+ * peers update (or create) their entry for us.
+ */
+static void
+arpSendGarp(IpBscIf pif)
+{
+rbuf_t    *p;
+LanArpPkt pa;
+
+	if ( ! (p = getrbuf()) )
+		return;
+
+	pa = &lpkt_arp_pkt( &p->pkt );
+	memcpy( pa, &pif->arpreq, sizeof(*pa) );
+	memset( pa->arp.tha, 0, 6 );
+	set_tpa( &pa->arp, pif->ipaddr );
+
+	pif->stats.arp_garp++;
+	NETDRV_ENQ_BUFFER( pif, p, sizeof(*pa) );
+}
+
+/* Callout: send remaining announcements (see arpAnnounce())                  */
+static void
+arpGarpTimer(void *arg0, void *arg1)
+{
+IpBscIf pif = arg0;
+int     more;
+
+	_Thread_Disable_dispatch();
+		if ( (more = (pif->arpgarpn > 0)) )
+			pif->arpgarpn--;
+		lanIpCallout_deactivate( &pif->arpgarpco );
+		if ( pif->arpgarpn )
+			lanIpCallout_reset( &pif->arpgarpco, pif->arpgarpival, arpGarpTimer, pif, 0 );
+	_Thread_Enable_dispatch();
+
+	if ( more )
+		arpSendGarp( pif );
+}
+
+int
+arpAnnounce(IpBscIf pif, unsigned count, unsigned ival_ms)
+{
+rtems_interval tps, ival;
+
+	rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &tps);
+
+	if ( 0 == (ival = ((uint64_t)ival_ms * tps + 999)/1000) )
+		ival = 1;
+
+	_Thread_Disable_dispatch();
+		/* restart a sequence that may still be in progress */
+		pif->arpgarpn    = count > 0 ? count - 1 : 0;
+		pif->arpgarpival = ival;
+		if ( pif->arpgarpn && ! lanIpCallout_active( &pif->arpgarpco ) )
+			lanIpCallout_reset( &pif->arpgarpco, ival, arpGarpTimer, pif, 0 );
+	_Thread_Enable_dispatch();
+
+	if ( count > 0 )
+		arpSendGarp( pif );
+
+	return 0;
+}
+
+/**** IGMP V3/V2 PROTOCOL IMPLEMENTATION **************************************/
 
 /* Inline helpers to determine the state of a MCA                             */
 
@@ -2787,22 +4409,29 @@ igmp_v1_rtr_seen(IpBscIf intrf)
 	return lanIpCallout_active( &intrf->mcIgmpV1RtrSeen);
 }
 
+/* IGMP version we currently use ('host compatibility mode', RFC3376)        */
+static int
+igmp_compat_version(IpBscIf intrf)
+{
+	if ( igmp_v1_rtr_seen( intrf ) )
+		return 1;
+#if IGMP_VERSION > 2
+	if ( lanIpCallout_active( &intrf->mcIgmpV2RtrSeen ) )
+		return 2;
+	return 3;
+#else
+	return 2;
+#endif
+}
+
+/* Prepare ethernet and IP header (with router-alert option) of an IGMP
+ * message with 'igmplen' bytes of payload to 'daddr'.
+ */
 static void
-igmp_prepare_msg(IpBscIf intrf, rbuf_t *buf_p, uint32_t gaddr, uint8_t type)
+igmp_prepare_iphdr(IpBscIf intrf, LanIpPart ipp, uint32_t daddr, int igmplen)
 {
-LanIgmpV2Pkt pigmp = &lpkt_igmpv2hdr( &buf_p->pkt );
 uint32_t     opt;
 uint16_t     s1, s2;
-uint32_t     daddr;
-LanIpPart    ipp   = &pigmp->ip_part;
-
-	if( IGMP_TYPE_LEAVE == type ) {
-		daddr = htonlc(IP_GRP_ALL_ROUTERS);
-	} else {
-		daddr = gaddr;
-		type  = igmp_v1_rtr_seen( intrf ) ? IGMP_TYPE_REPORT_V1 : IGMP_TYPE_REPORT_V2;
-	}
-
 
 	/* Prepare Ethernet Header -- src address is filled-in later */
 	ipmc2ethermc(daddr, ipp->ll.dst);
@@ -2810,7 +4439,7 @@ LanIpPart    ipp   = &pigmp->ip_part;
 
 	ipp->ip.vhl     = 0x46;          /* v4, header + rtr-alert option */
 	ipp->ip.tos     = 0x00;
-	ipp->ip.len     = htonsc(sizeof(IpHeaderRec) + 4 + sizeof(IgmpV2HeaderRec));
+	ipp->ip.len     = htons(sizeof(IpHeaderRec) + 4 + igmplen);
 	ipp->ip.id      = htonsc(0);
 	ipp->ip.off     = htonsc(0x4000); /* set DF flag */
 	ipp->ip.ttl     = 1;
@@ -2837,6 +4466,22 @@ LanIpPart    ipp   = &pigmp->ip_part;
 		s1++;
 
 	ipp->ip.csum    = ~s1;
+}
+
+static void
+igmp_prepare_msg(IpBscIf intrf, rbuf_t *buf_p, uint32_t gaddr, uint8_t type)
+{
+LanIgmpV2Pkt pigmp = &lpkt_igmpv2hdr( &buf_p->pkt );
+uint32_t     daddr;
+
+	if( IGMP_TYPE_LEAVE == type ) {
+		daddr = htonlc(IP_GRP_ALL_ROUTERS);
+	} else {
+		daddr = gaddr;
+		type  = igmp_v1_rtr_seen( intrf ) ? IGMP_TYPE_REPORT_V1 : IGMP_TYPE_REPORT_V2;
+	}
+
+	igmp_prepare_iphdr( intrf, &pigmp->ip_part, daddr, sizeof(IgmpV2HeaderRec) );
 
 	pigmp->igmp_u.ip46.igmp.type  = type;
 	pigmp->igmp_u.ip46.igmp.max_rtime = 0;
@@ -2846,14 +4491,52 @@ LanIpPart    ipp   = &pigmp->ip_part;
 	pigmp->igmp_u.ip46.igmp.csum  = ipcsum((uint8_t*) &pigmp->igmp_u.ip46.igmp, sizeof(pigmp->igmp_u.ip46.igmp));
 }
 
-/* NOTE: if the return value of igmp_send_msg() is dereferenced
- *       then the caller must acquire MCLOCK():
+/* Prepare IGMPv3 report with a single record reporting the state of 'mca'
+ * (a 'Leave' is reported as TO_IN {}).
  *
- *          MCLOCK();
- *             mca = igmp_send_msg();
- *             if ( mca )
- *                 use_mca(mca);
- *          MCUNLOCK();
+ * RETURNS: packet length.
+ */
+static int
+igmp_prepare_v3(IpBscIf intrf, rbuf_t *buf_p, IpBscMcAddr mca, uint8_t type)
+{
+LanIgmpV3RepPkt pigmp = &lpkt_igmpv3rep( &buf_p->pkt );
+McSrcFilt       sf    = IGMP_TYPE_LEAVE == type ? 0 : mca->mc_iff;
+unsigned        n     = sf ? sf->nsrc : 0;
+int             incl  = IGMP_TYPE_LEAVE == type || ( sf && LANIP_MCAST_INCLUDE == sf->mode );
+int             chg   = IGMP_TYPE_LEAVE == type || ( MC_FLG_IGMP_CHG & mca->mc_flags );
+int             len   = sizeof(pigmp->igmp) + sizeof(pigmp->rec) + n * sizeof(pigmp->rec.srcs[0]);
+
+	igmp_prepare_iphdr( intrf, &pigmp->ip_part, htonlc(IP_GRP_ALL_V3RTRS), len );
+
+	pigmp->igmp.type   = IGMP_TYPE_REPORT_V3;
+	pigmp->igmp.rsvd1  = 0;
+	pigmp->igmp.rsvd2  = 0;
+	pigmp->igmp.nrecs  = htonsc(1);
+
+	if ( chg )
+		pigmp->rec.rtype = incl ? IGMP_REC_TO_IN : IGMP_REC_TO_EX;
+	else
+		pigmp->rec.rtype = incl ? IGMP_REC_IS_IN : IGMP_REC_IS_EX;
+	pigmp->rec.auxlen  = 0;
+	pigmp->rec.nsrcs   = htons(n);
+	pigmp->rec.gaddr   = mca->mc_addr;
+	if ( n )
+		memcpy( pigmp->rec.srcs, sf->srcs, n * sizeof(pigmp->rec.srcs[0]) );
+
+	pigmp->igmp.csum   = 0;
+	pigmp->igmp.csum   = ipcsum((uint8_t*) &pigmp->igmp, len);
+
+	return sizeof(*pigmp) + n * sizeof(pigmp->rec.srcs[0]);
+}
+
+/* NOTE: if the return value of igmp_send_msg() is dereferenced
+ *       then the caller must acquire MCLOCK():
+ *
+ *          MCLOCK();
+ *             mca = igmp_send_msg();
+ *             if ( mca )
+ *                 use_mca(mca);
+ *          MCUNLOCK();
  *       
  *       It is not necessary to MCLOCK() if the return value
  *       is discarded or only used to find out if a message
@@ -2864,6 +4547,8 @@ igmp_send_msg(IpBscIf intrf, uint32_t gaddr, uint8_t type)
 {
 rbuf_t      *buf_p;
 IpBscMcAddr  mca = 0;
+int          v3  = ( 3 == igmp_compat_version( intrf ) );
+int          len;
 
 	buf_p = getrbuf();
 
@@ -2875,10 +4560,10 @@ IpBscMcAddr  mca = 0;
 				tstr = "REPORT (V1)";
 			break;
 			case IGMP_TYPE_REPORT_V2:
-				tstr = "REPORT (V2)";
+				tstr = v3 ? "REPORT (V3)" : "REPORT (V2)";
 			break;
 			case IGMP_TYPE_LEAVE:
-				tstr = "LEAVE (V2)";
+				tstr = v3 ? "LEAVE (V3 TO_IN {})" : "LEAVE (V2)";
 			break;
 			default:
 				tstr = "<UNKNOWN>";
@@ -2896,7 +4581,10 @@ IpBscMcAddr  mca = 0;
 			intrf->stats.igmp_txreportv1++;
 		break;
 		case IGMP_TYPE_REPORT_V2:
-			intrf->stats.igmp_txreportv2++;
+			if ( v3 )
+				intrf->stats.igmp_txreportv3++;
+			else
+				intrf->stats.igmp_txreportv2++;
 		break;
 		case IGMP_TYPE_LEAVE:
 			intrf->stats.igmp_txleave++;
@@ -2916,13 +4604,18 @@ IpBscMcAddr  mca = 0;
 	mca = lhtblFind( intrf->mctable, gaddr );
 
 	if ( buf_p && mca ) {
-		igmp_prepare_msg(intrf, buf_p, gaddr, type);
+		if ( v3 ) {
+			len = igmp_prepare_v3(intrf, buf_p, mca, type);
+		} else {
+			igmp_prepare_msg(intrf, buf_p, gaddr, type);
+			len = sizeof(lpkt_igmpv2hdr(&buf_p->pkt));
+		}
 		/* For the moment this routine does not do local loopback
 		 * but we need not see our own IGMP messages...
 		 */
 		/* adjust raw packet counter */
 		intrf->stats.eth_txrawfrm--;
-		lanIpBscSendBufRaw(intrf, &buf_p->pkt, sizeof(lpkt_igmpv2hdr(&buf_p->pkt)));
+		lanIpBscSendBufRaw(intrf, &buf_p->pkt, len);
 		buf_p = 0;
 	}
 
@@ -2960,108 +4653,698 @@ IpBscMcAddr mca;
 		/* msg type is corrected if the interface has recently seen a V1 query */
 		if ( (mca = igmp_send_msg(intrf, mcaddr, IGMP_TYPE_REPORT_V2)) ) {
 			mca->mc_flags |= MC_FLG_IGMP_LEAVE;
+			/* state-change report has been repeated */
+			mca->mc_flags &= ~MC_FLG_IGMP_CHG;
 			lanIpCallout_deactivate( &mca->mc_igmp );
 		}
 	MCUNLOCK( intrf );
 }
 
-static void
-igmp_v1timeo(void *arg0, void *arg1)
-{
-IpBscIf     intrf = arg1;
-#ifdef DEBUG
-	if ( lanIpDebug & (DEBUG_IGMP) ) {
-		printf("No IGMP V1 Query seen in a while (time expired); switching to V2\n");
+static void
+igmp_v1timeo(void *arg0, void *arg1)
+{
+IpBscIf     intrf = arg1;
+#ifdef DEBUG
+	if ( lanIpDebug & (DEBUG_IGMP) ) {
+		printf("No IGMP V1 Query seen in a while (time expired); switching to V2\n");
+	}
+#endif
+	MCLOCK(intrf);
+		lanIpCallout_deactivate( &intrf->mcIgmpV1RtrSeen );
+	MCUNLOCK(intrf);
+}
+
+static void
+igmp_v2timeo(void *arg0, void *arg1)
+{
+IpBscIf     intrf = arg1;
+#ifdef DEBUG
+	if ( lanIpDebug & (DEBUG_IGMP) ) {
+		printf("No IGMP V2 Query seen in a while (time expired); switching to V3\n");
+	}
+#endif
+	MCLOCK(intrf);
+		lanIpCallout_deactivate( &intrf->mcIgmpV2RtrSeen );
+	MCUNLOCK(intrf);
+}
+
+/* Source filters                                                             */
+
+static int
+u32cmp(const void *a, const void *b)
+{
+uint32_t x = *(const uint32_t*)a;
+uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : ( x > y ? 1 : 0 );
+}
+
+/* Sort the sources of 'sf' and remove duplicates                             */
+static void
+mcsf_sort(McSrcFilt sf)
+{
+unsigned i, n;
+
+	qsort( sf->srcs, sf->nsrc, sizeof(sf->srcs[0]), u32cmp );
+	for ( i = n = 0; i < sf->nsrc; i++ ) {
+		if ( 0 == n || sf->srcs[n-1] != sf->srcs[i] )
+			sf->srcs[n++] = sf->srcs[i];
+	}
+	sf->nsrc = n;
+}
+
+static int
+mcsf_has(McSrcFilt sf, uint32_t src)
+{
+int lo = 0, hi = (int)sf->nsrc - 1, m;
+
+	while ( lo <= hi ) {
+		m = (lo + hi) >> 1;
+		if ( sf->srcs[m] == src )
+			return 1;
+		if ( sf->srcs[m] < src )
+			lo = m + 1;
+		else
+			hi = m - 1;
+	}
+	return 0;
+}
+
+/* Check if datagrams from 'src' pass filter 'sf' (NULL passes everything)    */
+static inline int
+mcsf_pass(McSrcFilt sf, uint32_t src)
+{
+	return ! sf || ( mcsf_has( sf, src ) == ( LANIP_MCAST_INCLUDE == sf->mode ) );
+}
+
+static int
+mcsf_equal(McSrcFilt a, McSrcFilt b)
+{
+	if ( ! a || ! b )
+		return a == b;
+	return    a->mode == b->mode
+	       && a->nsrc == b->nsrc
+	       && 0 == memcmp( a->srcs, b->srcs, a->nsrc * sizeof(a->srcs[0]) );
+}
+
+/* Merge the socket filters of 'mca' into the filter of the interface
+ * (RFC3376, 3.2): if any socket is in EXCLUDE mode then the result is
+ * EXCLUDE (sources excluded by all EXCLUDE-mode sockets and not included
+ * by any INCLUDE-mode socket), otherwise it is INCLUDE (all sources
+ * included by any socket).
+ * Called with MCLOCK held.
+ *
+ * RETURNS: new filter or NULL for EXCLUDE {}. NULL is also returned if
+ *          an INCLUDE result would not fit in a report or if there is no
+ *          memory (we then receive everything and the socket filters
+ *          take care of the rest). For the same reason an EXCLUDE result
+ *          is truncated to what fits in a report.
+ */
+static McSrcFilt
+mcsf_merge(IpBscMcAddr mca)
+{
+McSrcFilt sf, ex = 0, rval;
+unsigned  i, n = 0;
+int       sd;
+
+	/* 'special' members never have a filter */
+	if ( (mca->mc_sobs & ~((1<<NSOCKS) - 1)) )
+		return 0;
+
+	for ( sd = 0; sd < NSOCKS; sd++ ) {
+		if ( ! (mca->mc_sobs & (1<<sd)) )
+			continue;
+		if ( ! (sf = mca->mc_sf[sd]) )
+			return 0;
+		if ( LANIP_MCAST_EXCLUDE == sf->mode ) {
+			if ( ! ex || sf->nsrc < ex->nsrc )
+				ex = sf;
+		} else {
+			n += sf->nsrc;
+		}
+	}
+
+	if ( ex ) {
+		n = ex->nsrc > IGMP_V3_MAXSRC ? IGMP_V3_MAXSRC : ex->nsrc;
+	} else if ( n > IGMP_V3_MAXSRC ) {
+		return 0;
+	}
+
+	if ( ! (rval = malloc( sizeof(*rval) + n * sizeof(rval->srcs[0]) )) )
+		return 0;
+
+	n = 0;
+	if ( ex ) {
+		rval->mode = LANIP_MCAST_EXCLUDE;
+		for ( i = 0; i < ex->nsrc && n < IGMP_V3_MAXSRC; i++ ) {
+			for ( sd = 0; sd < NSOCKS; sd++ ) {
+				if ( ! (mca->mc_sobs & (1<<sd)) )
+					continue;
+				sf = mca->mc_sf[sd];
+				if ( ( LANIP_MCAST_EXCLUDE == sf->mode ) != mcsf_has( sf, ex->srcs[i] ) )
+					break;
+			}
+			if ( NSOCKS == sd )
+				rval->srcs[n++] = ex->srcs[i];
+		}
+		if ( 0 == n ) {
+			free( rval );
+			return 0;
+		}
+		rval->nsrc = n;
+	} else {
+		rval->mode = LANIP_MCAST_INCLUDE;
+		for ( sd = 0; sd < NSOCKS; sd++ ) {
+			if ( (mca->mc_sobs & (1<<sd)) ) {
+				sf = mca->mc_sf[sd];
+				memcpy( rval->srcs + n, sf->srcs, sf->nsrc * sizeof(sf->srcs[0]) );
+				n += sf->nsrc;
+			}
+		}
+		rval->nsrc = n;
+		mcsf_sort( rval );
+	}
+
+	return rval;
+}
+
+/* Update the 'filtered' state and the IF filter of 'mca' after a socket
+ * filter or the set of members changed; if the IF filter changes while we
+ * speak IGMPv3 then a state-change report is sent (and repeated once).
+ * Called with MCLOCK held.
+ */
+static void
+mcsf_update(IpBscIf intrf, IpBscMcAddr mca)
+{
+McSrcFilt      nf, of = mca->mc_iff;
+int            sd, hassf = 0;
+rtems_interval ticks_per_s;
+
+	for ( sd = 0; sd < NSOCKS; sd++ ) {
+		if ( mca->mc_sf[sd] )
+			hassf = 1;
+	}
+
+	if ( hassf && ! (MC_FLG_SRCFILT & mca->mc_flags) ) {
+		mca->mc_flags |= MC_FLG_SRCFILT;
+		intrf->mcnsf++;
+	} else if ( ! hassf && (MC_FLG_SRCFILT & mca->mc_flags) ) {
+		mca->mc_flags &= ~MC_FLG_SRCFILT;
+		intrf->mcnsf--;
+	}
+
+	nf = mcsf_merge( mca );
+
+	if ( mcsf_equal( nf, of ) ) {
+		free( nf );
+		return;
+	}
+
+	mca->mc_iff = nf;
+	free( of );
+
+	if ( ISMCST_ALLSYS( mca->mc_addr ) || igmp_compat_version( intrf ) < 3 )
+		return;
+
+	rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &ticks_per_s);
+
+	mca->mc_flags |= MC_FLG_IGMP_CHG;
+	igmp_send_msg( intrf, mca->mc_addr, IGMP_TYPE_REPORT_V2 );
+
+	/* NOTE: we ignore failure of 'reset' (callback executing) */
+	lanIpCallout_reset(
+		& mca->mc_igmp,
+		badrand16() % (1 /* sec, 'unsolicited report interval' (RFC3376) */ * ticks_per_s),
+		igmp_timeo,
+		(void*)mca->mc_addr,
+		intrf
+	);
+}
+
+/* Check if a datagram to group 'gaddr' from 'src' passes the IF filter      */
+static int
+mcSrcAccept(IpBscIf pif, uint32_t gaddr, uint32_t src)
+{
+IpBscMcAddr mca;
+int         rval;
+
+	_Thread_Disable_dispatch();
+		rval = ! (mca = lhtblFind( pif->mctable, gaddr )) || mcsf_pass( mca->mc_iff, src );
+	_Thread_Enable_dispatch();
+
+	return rval;
+}
+
+/* Check if a datagram to group 'gaddr' from 'src' passes the filter of
+ * socket 'sd'; must be called with dispatching disabled.
+ */
+static int
+mcSockSrcAccept(IpBscIf pif, uint32_t gaddr, uint32_t src, int sd)
+{
+IpBscMcAddr mca;
+
+	if ( ! (mca = lhtblFind( pif->mctable, gaddr )) )
+		return 1;
+	return mcsf_pass( mca->mc_sf[sd], src );
+}
+
+/**** HIGH PRIORITY PROTOCOL HANDLING *****************************************/
+
+/* These routines execute in the context of the high-priority driver task when
+ * new packets arrive.
+ * They are responsible for
+ *   - defer low-priority work (ARP, ICMP, IGMP) to low-priority worker task
+ *   - dispatching UDP packets to user sockets
+ */
+
+/* Handle ARP requests and reply packets we receive                           */
+
+static int
+handleArp(rbuf_t **ppbuf, IpBscIf pif)
+{
+rbuf_t		*p    = *ppbuf;
+IpArpRec	*pipa = &lpkt_arp(&p->pkt);
+uint32_t    xx;
+
+
+	 /* 0x0001 == Ethernet, 0x0800 == IP */
+	NETDRV_READ_INCREMENTAL(pif, pipa, 8);
+	if ( htonlc(0x00010800) != *(uint32_a_t*)pipa ) {
+		pif->stats.arp_protdropped++;
+		return 8;
+	}
+
+	xx = * ( (uint32_a_t *) pipa + 1 );
+
+	/* 0x06 hw addr len, 0x04 proto len, 0x0001 ARP REQUEST */
+	/* 0x06 hw addr len, 0x04 proto len, 0x0002 ARP REPLY   */
+	if ( htonlc(0x06040001) != xx && htonlc(0x06040002) != xx ) {
+		pif->stats.arp_lenopdropped++;
+		return 8;
+	}
+
+	/* Fill rest of ARP packet            */
+	NETDRV_READ_INCREMENTAL(pif, pipa->sha, 5*4);
+
+	scheduleLpWork(pif, p);
+	*ppbuf = 0; 
+
+	return sizeof(*pipa);
+}
+
+/* Refresh or create a new ARP entry. We mock up a fake UDP packet and schedule
+ * the real work (arpPutEntry()) for the low-priority worker task.
+ */
+
+static void
+scheduleRefreshArp(IpBscIf pif, LanUdpPkt pudp)
+{
+rbuf_t         *nbuf;
+rtems_interval now, ival = lanIpBscAutoRefreshARPTicks;
+ArpRfPendRec   *d;
+
+	if ( ival ) {
+		now = rtems_clock_get_ticks_since_boot();
+
+		/* Most packets come from peers whose entry is fresh      */
+		if ( 0 == arp_find_fresh( pif, pudp->ip_part.ip.src, pudp->ip_part.ll.src, now, ival ) ) {
+			pif->stats.arp_rfskipped++;
+			return;
+		}
+
+		/* Don't schedule again while lpWorker has not caught up;
+		 * racing senders (loopback) may at worst cause an extra
+		 * refresh.
+		 */
+		d = &pif->arprfpend[ ARPHASH(pif, pudp->ip_part.ip.src) & (ARP_RFPEND_SZ - 1) ];
+		if (    d->ipaddr == pudp->ip_part.ip.src
+		     && now - d->tick < ival
+		     && ! memcmp( d->hwaddr, pudp->ip_part.ll.src, 6 ) ) {
+			pif->stats.arp_rfskipped++;
+			return;
+		}
+		d->ipaddr = pudp->ip_part.ip.src;
+		d->tick   = now;
+		memcpy( d->hwaddr, pudp->ip_part.ll.src, 6 );
+	}
+
+	if ( (nbuf = getrbuf()) ) { 
+		pif->stats.arp_rfsched++;
+
+		/* fake up a new buffer; copy just enough info for the
+		 * low-priority worker...
+		 *
+		 * Unfortunately, we can't just refrbuf() and pass the
+		 * same buffer on since the user might receive and
+		 * modify it (user 'owns' received buffer).
+		 */
+
+		/* It's IPv4 */
+		lpkt_eth( &nbuf->pkt ).type = htonsc(0x800);
+
+		/* It's UDP */
+		lpkt_ip( &nbuf->pkt ).prot  = IP_PROT_UDP;
+
+		/* Just because the length is read by lpWorker... */
+		lpkt_ip( &nbuf->pkt ).len   = pudp->ip_part.ip.len;
+
+		/* Copy the relevant addresses */
+		lpkt_ip( &nbuf->pkt ).src   = pudp->ip_part.ip.src;
+		memcpy(
+			lpkt_eth( &nbuf->pkt ).src,
+			pudp->ip_part.ll.src,
+			sizeof(lpkt_eth( &nbuf->pkt ).src)
+		);
+
+		/* There it goes */
+		scheduleLpWork(pif, nbuf);
+	}
+}
+
+/**** IP FRAGMENTATION AND REASSEMBLY ****************************************/
+
+/* Offset, 'more-fragments' flag and payload length of an IP (fragment) header */
+#define IPFRAG_OFF(pip)		((ntohs((pip)->off) & 0x1fff) << 3)
+#define IPFRAG_MF(pip)		(ntohs((pip)->off) & 0x2000)
+#define IPFRAG_LEN(pip)		((int)ntohs((pip)->len) - (int)sizeof(IpHeaderRec))
+
+#if IP_REASM_NENTRIES > 0
+
+/* Fragments of UDP datagrams are collected in a small, fixed-size table
+ * (per interface). The fragment buffers of a datagram are chained, sorted
+ * by offset, via the rbuf's 'frag' pointer (no copying) and the complete
+ * chain is handed to a socket which enabled fragmentation
+ * (udpSockSetFragmentation()). Each entry has a callout which discards an
+ * incomplete datagram.
+ * Memory is strictly bounded: an interface never holds more than
+ * IP_REASM_NENTRIES * IP_REASM_MAXFRAGS rbufs for reassembly.
+ *
+ * The table is accessed by the RX task and the callout task; it is
+ * protected by disabling thread dispatching (as the socket table).
+ */
+
+/* Max. IP payload carried by a fragment                                      */
+#define IPFRAG_DATASZ		(IPPAYLOADSIZE & ~7)
+
+/* Max. UDP payload of a fragmented datagram                                  */
+#define UDPFRAGPAYLOADSIZE	(IP_REASM_MAXFRAGS * IPFRAG_DATASZ - sizeof(UdpHeaderRec))
+
+/* Release all fragments and invalidate a pending timeout; dispatching
+ * must be disabled.
+ */
+static void
+ipReasmRelease(IpReasm e)
+{
+	relrbuf( e->frags );
+	e->frags  = 0;
+	e->nfrags = 0;
+	e->have   = 0;
+	e->total  = 0;
+	e->gen++;
+}
+
+/* Callout: discard an incomplete datagram                                    */
+static void
+ipReasmTimeout(void *arg0, void *arg1)
+{
+IpReasm e = arg0;
+
+	_Thread_Disable_dispatch();
+		/* entry may have completed (and been reused) meanwhile */
+		if ( e->frags && e->gen == (unsigned)(uintptr_t)arg1 ) {
+			e->pif->stats.ip_reasmtimo++;
+			ipReasmRelease( e );
+		}
+		lanIpCallout_deactivate( &e->timo );
+	_Thread_Enable_dispatch();
+}
+
+/* Pass a reassembled datagram to a socket                                    */
+static void
+ipReasmDeliver(IpBscIf pif, rbuf_t *p, int total)
+{
+LanUdpPkt     pudp = &lpkt_udp_hdrs(&p->pkt);
+LanUdpPkt     hdr;
+UdpSockMsgRec msg;
+uint16_t      dport;
+int           i;
+
+	/* first fragment must hold the UDP header which must agree */
+	if (    IPFRAG_OFF( &pudp->ip_part.ip ) != 0
+	     || IPFRAG_LEN( &pudp->ip_part.ip ) < sizeof(pudp->udp)
+	     || ntohs( pudp->udp.len ) != total ) {
+		pif->stats.udp_hdrdropped++;
+		relrbuf( p );
+		return;
+	}
+
+	dport = ntohs(pudp->udp.dport);
+
+	_Thread_Disable_dispatch();
+	for ( i=0; i<NSOCKS; i++ ) {
+		if ( socks[i].port != dport )
+			continue;
+
+		if ( ! (FLG_FRAG & socks[i].flags) ) {
+			/* socket can't deal with chained buffers */
+			pif->stats.ip_frgdropped++;
+			break;
+		}
+
+		/* Apply the socket's multicast source filter */
+		if (    pif->mcnsf
+		     && ISMCST( pudp->ip_part.ip.dst )
+		     && ! mcSockSrcAccept( pif, pudp->ip_part.ip.dst, pudp->ip_part.ip.src, i ) ) {
+			pif->stats.ip_mcsrcdropped++;
+			break;
+		}
+
+		if ( FLG_ISCONN == ((FLG_ISCONN | FLG_MCPASS) & socks[i].flags) ) {
+			hdr = &socks[i].hdr;
+			/* filter source IP and port */
+			if (    hdr->udp.dport  != pudp->udp.sport
+				|| (hdr->ip_part.ip.dst != pudp->ip_part.ip.src && ! ISBCST(hdr->ip_part.ip.dst, socks[i].intrf->nmask)) ) {
+				pif->stats.udp_sadropped++;
+				break;
+			}
+		}
+
+		msg.pkt = p;
+		msg.len = total - sizeof(UdpHeaderRec);
+
+		/* post to user */
+		if ( RTEMS_SUCCESSFUL == rtems_message_queue_send(socks[i].msgq, &msg, sizeof(msg)) ) {
+			socks[i].nbytes += msg.len;
+			/* they now own the buffer */
+			p = 0;
+			pif->stats.udp_rxfrm++;
+			pif->stats.udp_rxbytes+=msg.len;
+		} else {
+			pif->stats.udp_nospcdropped++;
+		}
+		break;
+	}
+	_Thread_Enable_dispatch();
+
+	relrbuf( p );
+}
+
+/* Add a fragment (the IP header has been read already) to the reassembly
+ * table and deliver the datagram once it is complete.
+ *
+ * RETURNS: number of bytes read from the device.
+ */
+static int
+ipReasmInput(rbuf_t **ppbuf, IpBscIf pif, int loopback)
+{
+rbuf_t         *p   = *ppbuf;
+IpHeaderRec    *pip = &lpkt_ip(&p->pkt);
+rbuf_t         *f, **pp, *done = 0;
+IpReasm        e, fre = 0;
+int            off, len, end, fo, l, i, tot = 0;
+rtems_interval ticks;
+
+	off = IPFRAG_OFF( pip );
+	len = IPFRAG_LEN( pip );
+	end = off + len;
+
+	if (    len <= 0
+	     || ntohs(pip->len) > sizeof( p->pkt ) - sizeof(EthHeaderRec) ) {
+		pif->stats.ip_lendropped++;
+		return 0;
+	}
+
+	l = (len + 3) & ~3;
+
+	/* slurp fragment payload */
+	if ( ! loopback )
+		NETDRV_READ_INCREMENTAL(pif, &lpkt_udp_hdrs(&p->pkt).udp, l);
+
+	/* all but the last fragment carry multiples of 8 bytes;
+	 * don't accept anything we would not be able to reassemble.
+	 */
+	if (    ( IPFRAG_MF( pip ) && (len & 7) )
+	     || end > IP_REASM_MAXFRAGS * IPFRAG_DATASZ ) {
+		pif->stats.ip_reasmdropped++;
+		return l;
 	}
-#endif
-	MCLOCK(intrf);
-		lanIpCallout_deactivate( &intrf->mcIgmpV1RtrSeen );
-	MCUNLOCK(intrf);
-}
 
-/**** HIGH PRIORITY PROTOCOL HANDLING *****************************************/
+	rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &ticks);
+	ticks = (IP_REASM_TIMEOUT_MS * ticks + 999) / 1000;
 
-/* These routines execute in the context of the high-priority driver task when
- * new packets arrive.
- * They are responsible for
- *   - defer low-priority work (ARP, ICMP, IGMP) to low-priority worker task
- *   - dispatching UDP packets to user sockets
- */
+	_Thread_Disable_dispatch();
 
-/* Handle ARP requests and reply packets we receive                           */
+	for ( i=0, e=pif->reasm; i<IP_REASM_NENTRIES; i++, e++ ) {
+		if ( ! e->frags ) {
+			/* a stale timeout may still have to run */
+			if ( ! fre && ! lanIpCallout_active( &e->timo ) )
+				fre = e;
+		} else if ( e->id == pip->id && e->src == pip->src && e->dst == pip->dst ) {
+			break;
+		}
+	}
 
-static int
-handleArp(rbuf_t **ppbuf, IpBscIf pif)
-{
-rbuf_t		*p    = *ppbuf;
-IpArpRec	*pipa = &lpkt_arp(&p->pkt);
-uint32_t    xx;
+	if ( i == IP_REASM_NENTRIES ) {
+		if ( ! (e = fre) ) {
+			pif->stats.ip_reasmdropped++;
+			goto bail;
+		}
+		e->src = pip->src;
+		e->dst = pip->dst;
+		e->id  = pip->id;
+		lanIpCallout_reset( &e->timo, ticks, ipReasmTimeout, e, (void*)(uintptr_t)e->gen );
+	}
 
+	if (    e->nfrags >= IP_REASM_MAXFRAGS
+	     || ( e->total && end > e->total )
+	     || ( ! IPFRAG_MF( pip ) && (e->total || end < e->have) ) ) {
+		pif->stats.ip_reasmdropped++;
+		goto bail;
+	}
 
-	 /* 0x0001 == Ethernet, 0x0800 == IP */
-	NETDRV_READ_INCREMENTAL(pif, pipa, 8);
-	if ( htonlc(0x00010800) != *(uint32_a_t*)pipa ) {
-		pif->stats.arp_protdropped++;
-		return 8;
+	/* nothing queued may extend beyond the last fragment; otherwise
+	 * 'have' could reach 'total' with a hole in the datagram.
+	 */
+	if ( ! IPFRAG_MF( pip ) ) {
+		for ( f = e->frags; f; f = f->buf.frag ) {
+			if ( IPFRAG_OFF( &lpkt_ip(&f->pkt) ) + IPFRAG_LEN( &lpkt_ip(&f->pkt) ) > end ) {
+				pif->stats.ip_reasmdropped++;
+				goto bail;
+			}
+		}
 	}
 
-	xx = * ( (uint32_a_t *) pipa + 1 );
+	/* find insertion point; reject overlapping (or duplicate) fragments */
+	for ( pp = &e->frags; (f = *pp); pp = &f->buf.frag ) {
+		fo = IPFRAG_OFF( &lpkt_ip(&f->pkt) );
+		if ( fo >= end )
+			break;
+		if ( fo + IPFRAG_LEN( &lpkt_ip(&f->pkt) ) > off ) {
+			pif->stats.ip_reasmdropped++;
+			goto bail;
+		}
+	}
 
-	/* 0x06 hw addr len, 0x04 proto len, 0x0001 ARP REQUEST */
-	/* 0x06 hw addr len, 0x04 proto len, 0x0002 ARP REPLY   */
-	if ( htonlc(0x06040001) != xx && htonlc(0x06040002) != xx ) {
-		pif->stats.arp_lenopdropped++;
-		return 8;
+	p->buf.frag = f;
+	*pp         = p;
+	*ppbuf      = 0;
+	e->nfrags++;
+	e->have    += len;
+	if ( ! IPFRAG_MF( pip ) )
+		e->total = end;
+
+	pif->stats.ip_rxfrag++;
+
+	if ( e->total && e->have == e->total ) {
+		/* complete; take the chain off the table */
+		done      = e->frags;
+		tot       = e->total;
+		e->frags  = 0;
+		e->nfrags = 0;
+		e->have   = 0;
+		e->total  = 0;
+		e->gen++;
+		/* if the callout is already executing then it finds
+		 * a new 'gen' and just deactivates itself.
+		 */
+		lanIpCallout_trystop( &e->timo );
+		pif->stats.ip_reasmok++;
 	}
 
-	/* Fill rest of ARP packet            */
-	NETDRV_READ_INCREMENTAL(pif, pipa->sha, 5*4);
+bail:
+	_Thread_Enable_dispatch();
 
-	scheduleLpWork(pif, p);
-	*ppbuf = 0; 
+	if ( done )
+		ipReasmDeliver( pif, done, tot );
 
-	return sizeof(*pipa);
+	return l;
 }
 
-/* Refresh or create a new ARP entry. We mock up a fake UDP packet and schedule
- * the real work (arpPutEntry()) for the low-priority worker task.
+/* Send a UDP datagram which doesn't fit into a single frame as a series of
+ * IP fragments. 'h' is the complete header for the entire datagram (the
+ * socket must be locked).
+ *
+ * RETURNS: 'payload_len' or negative error status.
  */
-
-static void
-scheduleRefreshArp(IpBscIf pif, LanUdpPkt pudp)
+static int
+ipFragSend(IpBscIf pif, int sd, LanUdpPkt h, uint8_t *payload, int payload_len)
 {
-rbuf_t       *nbuf;
-	if ( (nbuf = getrbuf()) ) { 
-		/* fake up a new buffer; copy just enough info for the
-		 * low-priority worker...
-		 *
-		 * Unfortunately, we can't just refrbuf() and pass the
-		 * same buffer on since the user might receive and
-		 * modify it (user 'owns' received buffer).
-		 */
+int       tot = payload_len + sizeof(h->udp);
+int       off, n, len;
+rbuf_t    *b;
+LanUdpPkt fh;
+uint8_t   *d;
+uint16_t  id;
 
-		/* It's IPv4 */
-		lpkt_eth( &nbuf->pkt ).type = htonsc(0x800);
+	_Thread_Disable_dispatch();
+		id = htons( pif->ipid++ );
+	_Thread_Enable_dispatch();
 
-		/* It's UDP */
-		lpkt_ip( &nbuf->pkt ).prot  = IP_PROT_UDP;
+	for ( off = 0; off < tot; off += n ) {
+		if ( (n = tot - off) > IPFRAG_DATASZ )
+			n = IPFRAG_DATASZ;
 
-		/* Just because the length is read by lpWorker... */
-		lpkt_ip( &nbuf->pkt ).len   = pudp->ip_part.ip.len;
+		if ( ! (b = getrbuf()) )
+			return -ENOBUFS;
 
-		/* Copy the relevant addresses */
-		lpkt_ip( &nbuf->pkt ).src   = pudp->ip_part.ip.src;
-		memcpy(
-			lpkt_eth( &nbuf->pkt ).src,
-			pudp->ip_part.ll.src,
-			sizeof(lpkt_eth( &nbuf->pkt ).src)
-		);
+		fh = &lpkt_udp_hdrs( &b->pkt );
+		memcpy( &fh->ip_part, &h->ip_part, sizeof(fh->ip_part) );
 
-		/* There it goes */
-		scheduleLpWork(pif, nbuf);
+		/* fragment payload starts where the UDP header would be */
+		d = (uint8_t*)&fh->udp;
+		if ( 0 == off ) {
+			memcpy( d, &h->udp, sizeof(h->udp) );
+			memcpy( d + sizeof(h->udp), payload, n - sizeof(h->udp) );
+			payload += n - sizeof(h->udp);
+		} else {
+			memcpy( d, payload, n );
+			payload += n;
+		}
+
+		fh->ip_part.ip.len = htons( sizeof(IpHeaderRec) + n );
+		fh->ip_part.ip.id  = id;
+		/* clears DF */
+		fh->ip_part.ip.off = htons( (off >> 3) | (off + n < tot ? 0x2000 : 0) );
+		memset( &fh->ip_part.ip.csum, 0, sizeof(fh->ip_part.ip.csum) );
+		fh->ip_part.ip.csum = in_cksum_hdr( (void*)&fh->ip_part.ip );
+
+		len = sizeof(fh->ip_part) + n;
+
+#ifdef NETDRV_TRY_ENQ_BUFFER
+		if ( txprio_send( pif, socks[sd].txprio, b, len, socks[sd].txtmo ) <= 0 ) {
+			/* remaining fragments would be useless */
+			return -ENOBUFS;
+		}
+#else
+		NETDRV_ENQ_BUFFER( pif, b, len );
+#endif
+		pif->stats.ip_txfrag++;
 	}
+
+	return payload_len;
 }
 
+#endif
+
 /* Handle IPv4 protocol (ICMP, IGMP, UDP)                                     */
 
 static int
@@ -3083,6 +5366,11 @@ LanUdpPkt    hdr;
 	if ( (pip->dst == pif->ipaddr) ) {
 		pif->stats.ip_rxufrm++;
 	} else if ( (ismcst = mcListener(pif, pip->dst)) ) {
+		/* Drop unwanted sources before doing any more work */
+		if ( pif->mcnsf && ! mcSrcAccept(pif, pip->dst, pip->src) ) {
+			pif->stats.ip_mcsrcdropped++;
+			return rval;
+		}
 		pif->stats.ip_rxmfrm++;
 	} else if ( (isbcst = ISBCST(pip->dst, pif->nmask)) ) {
 		pif->stats.ip_rxbfrm++;
@@ -3136,6 +5424,11 @@ LanUdpPkt    hdr;
      * (more fragments) or an offset.
 	 */
 	if ( ntohs(pip->off) & 0x9fff ) {
+#if IP_REASM_NENTRIES > 0
+		if ( IP_PROT_UDP == pip->prot && ! check_vhl(pip->vhl, 0x45) && ! (ntohs(pip->off) & 0x8000) ) {
+			return rval + ipReasmInput(ppbuf, pif, loopback);
+		}
+#endif
 		pif->stats.ip_frgdropped++;
 #ifdef DEBUG
 		if ( (lanIpDebug & DEBUG_IP) )
@@ -3247,6 +5540,12 @@ LanUdpPkt    hdr;
 			_Thread_Disable_dispatch();
 			for ( i=0; i<NSOCKS; i++ ) {
 				if ( socks[i].port == dport ) {
+					/* Apply the socket's multicast source filter */
+					if ( ismcst && pif->mcnsf && ! mcSockSrcAccept(pif, pip->dst, pip->src, i) ) {
+						_Thread_Enable_dispatch();
+						pif->stats.ip_mcsrcdropped++;
+						return rval;
+					}
 					/* Skip source filtering if socket is not connected or
 					 * FLG_MCPASS is set.
 					 */
@@ -3316,6 +5615,75 @@ LanUdpPkt    hdr;
 	return rval;
 }
 
+/* Loop a locally subscribed multicast packet we just sent back to a socket.
+ * The headers were built (or checked) by the sender and we know the group
+ * is subscribed, hence this bypasses handleIP() (header validation, group
+ * lookup, ARP refresh) and goes straight to the socket queue.
+ * Packets other than plain UDP are still passed through handleIP().
+ * On success the socket takes over the (shared) buffer and *ppbuf is
+ * set to NULL.
+ */
+static void
+mcLoopback(IpBscIf pif, rbuf_t **ppbuf)
+{
+rbuf_t        *p    = *ppbuf;
+LanUdpPkt     pudp  = &lpkt_udp_hdrs(&p->pkt);
+LanUdpPkt     hdr;
+UdpSockMsgRec msg;
+uint16_t      dport;
+int           i;
+
+	pif->stats.ip_txmcloopback++;
+	/* all received bufs have the IF handle set... */
+	p->buf.intrf = pif;
+
+	if (    IP_PROT_UDP != pudp->ip_part.ip.prot
+	     || 0x45 != pudp->ip_part.ip.vhl
+	     || (ntohs(pudp->ip_part.ip.off) & 0x9fff) ) {
+		handleIP( ppbuf, pif, 1 /* loopback */ );
+		return;
+	}
+
+	pif->stats.ip_rxmfrm++;
+
+	dport   = ntohs(pudp->udp.dport);
+	msg.pkt = p;
+	msg.len = ntohs(pudp->ip_part.ip.len) - sizeof(IpHeaderRec) - sizeof(UdpHeaderRec);
+
+	_Thread_Disable_dispatch();
+	for ( i=0; i<NSOCKS; i++ ) {
+		if ( socks[i].port != dport )
+			continue;
+
+		if ( pif->mcnsf && ! mcSockSrcAccept(pif, pudp->ip_part.ip.dst, pudp->ip_part.ip.src, i) ) {
+			pif->stats.ip_mcsrcdropped++;
+			break;
+		}
+
+		if ( FLG_ISCONN == ((FLG_ISCONN | FLG_MCPASS) & socks[i].flags) ) {
+			hdr = &socks[i].hdr;
+			/* filter source IP and port */
+			if (    hdr->udp.dport  != pudp->udp.sport
+				|| (hdr->ip_part.ip.dst != pudp->ip_part.ip.src && ! ISBCST(hdr->ip_part.ip.dst, socks[i].intrf->nmask)) ) {
+				pif->stats.udp_sadropped++;
+				break;
+			}
+		}
+
+		if ( RTEMS_SUCCESSFUL == rtems_message_queue_send(socks[i].msgq, &msg, sizeof(msg)) ) {
+			socks[i].nbytes += msg.len;
+			/* they now own the buffer */
+			*ppbuf = 0;
+			pif->stats.udp_rxfrm++;
+			pif->stats.udp_rxbytes+=msg.len;
+		} else {
+			pif->stats.udp_nospcdropped++;
+		}
+		break;
+	}
+	_Thread_Enable_dispatch();
+}
+
 /* Handle ARP, IGMP and ICMP echo (ping) requests
  * Dispatch UDP packets to trivial 'sockets'
  *
@@ -3576,6 +5944,9 @@ LanIpPart        ipp;
 			intrf->stats.igmp_rxreportv2--;
 		case IGMP_TYPE_REPORT_V2:
 			intrf->stats.igmp_rxreportv2++;
+			/* IGMPv3 hosts never suppress their reports */
+			if ( 3 == igmp_compat_version( intrf ) )
+				break;
 			mca = lhtblFind( intrf->mctable, pigmp->gaddr);
 			if ( igmp_state_delaying( mca ) ) {
 #ifdef DEBUG
@@ -3594,7 +5965,23 @@ LanIpPart        ipp;
 
 			rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &ticks_per_s);
 
-			if ( igmp_query_is_v1( pigmp ) ) {
+			/* Query version is determined by length (RFC3376, 7.1) */
+			if ( pldlen >= sizeof(IgmpV3QueryHeaderRec) ) {
+				intrf->stats.igmp_rxqueryv3++;
+#ifdef DEBUG
+				if ( lanIpDebug & (DEBUG_IGMP) ) {
+					printf("IGMP V3 Query seen -- ");
+				}
+#endif
+				/* Source-specific queries are answered with our complete
+				 * state for the group.
+				 */
+				report_dly_ticks = pigmp->max_rtime;
+				if ( report_dly_ticks >= 128 ) {
+					/* floating-point format */
+					report_dly_ticks = ((report_dly_ticks & 0xf) | 0x10) << (((report_dly_ticks >> 4) & 7) + 3);
+				}
+			} else if ( igmp_query_is_v1( pigmp ) ) {
 				intrf->stats.igmp_rxqueryv1++;
 #ifdef DEBUG
 				if ( lanIpDebug & (DEBUG_IGMP) ) {
@@ -3621,6 +6008,16 @@ LanIpPart        ipp;
 				if ( lanIpDebug & (DEBUG_IGMP) ) {
 					printf("IGMP V2 Query seen -- ");
 				}
+#endif
+#if IGMP_VERSION > 2
+				/* fall back to V2 (ignoring failure as above) */
+				lanIpCallout_reset(
+					&intrf->mcIgmpV2RtrSeen,
+					400 /* sec, 'older version querier present timeout' (RFC3376) */ * ticks_per_s,
+					igmp_v2timeo,
+					0,
+					intrf
+				);
 #endif
 				report_dly_ticks = pigmp->max_rtime;
 			}
@@ -3629,6 +6026,9 @@ LanIpPart        ipp;
 			report_dly_ticks *= ticks_per_s;
 			report_dly_ticks /= 10;
 
+			if ( 0 == report_dly_ticks )
+				report_dly_ticks = 1;
+
 			if (   htonlc(0) == pigmp->gaddr
 				&& ISMCST_ALLSYS(ipp->ip.dst)   ) {
 #ifdef DEBUG
@@ -3776,6 +6176,8 @@ lanIpBscIfAlloc()
 {
 IpBscIf          		rval = malloc(sizeof(*rval));
 rtems_interrupt_level	key;
+unsigned                sz;
+int                     i;
 
 	if ( !rval )
 		return 0;
@@ -3793,12 +6195,19 @@ rtems_interrupt_level	key;
 
 	memset( rval, 0, sizeof(*rval) );
 
-	if ( ! (arpcache(rval)[ARP_SENTINEL] = arp_allocentry()) ) {
+	/* ARP cache size: power of two, at least CACHE_OVERLAP */
+	for ( i = 0, sz = 1; sz < lanIpBscCfg.arp_cache_size || sz < CACHE_OVERLAP; i++ )
+		sz <<= 1;
+	rval->arpmsk  = sz - 1;
+	rval->arpshft = 32 - i;
+
+	if (   ! (rval->arphtbl  = calloc(sz, sizeof(*rval->arphtbl)))
+	    || ! (rval->arpseq   = calloc(sz, sizeof(*rval->arpseq)))
+	    || ! (rval->arpatime = calloc(sz, sizeof(*rval->arpatime))) ) {
+		fprintf(stderr, "lanIpCb: no memory for ARP cache\n");
 		goto bail;
 	}
 
-	arpcache(rval)[ARP_SENTINEL]->ctime = ARP_PERM;
-
 	if ( ! (rval->arpbuf = getrbuf()) )
 		goto bail;
 
@@ -3808,6 +6217,16 @@ rtems_interrupt_level	key;
 		goto bail;
 	}
 
+	if ( ! (rval->txmutx = bsem_create("iptx", SEM_MUTX)) ) {
+		fprintf(stderr, "lanIpCb: unable to create TX mutex\n");
+		goto bail;
+	}
+
+	if ( ! (rval->txwsem = bsem_create("iptw", SEM_SYNC)) ) {
+		fprintf(stderr, "lanIpCb: unable to create TX wait semaphore\n");
+		goto bail;
+	}
+
 	if ( ! ( rval->mctable = lhtblCreate(
 								1000,
 								(unsigned long) (&((IpBscMcAddr)0)->mc_addr)
@@ -3822,7 +6241,9 @@ rtems_interrupt_level	key;
 bail:
 	intrf = 0;
 
-	arp_destroyentry(arpcache(rval)[ARP_SENTINEL]);
+	free( rval->arphtbl );
+	free( (void*)rval->arpseq );
+	free( (void*)rval->arpatime );
 
 	if ( rval->mctable )
 		lhtblDestroy(rval->mctable, 0, 0);
@@ -3833,6 +6254,12 @@ bail:
 	if ( rval->mutx )
 		rtems_semaphore_delete( rval->mutx );
 
+	if ( rval->txmutx )
+		rtems_semaphore_delete( rval->txmutx );
+
+	if ( rval->txwsem )
+		rtems_semaphore_delete( rval->txwsem );
+
 	free(rval);
 
 	return 0;
@@ -3915,6 +6342,21 @@ IpBscIf           ipbif_p;
 	ipbif_p->mclist.r_node = 0;
 
 	lanIpCallout_init( &ipbif_p->mcIgmpV1RtrSeen );
+	lanIpCallout_init( &ipbif_p->mcIgmpV2RtrSeen );
+	lanIpCallout_init( &ipbif_p->arpholdco );
+	lanIpCallout_init( &ipbif_p->arpageco );
+	lanIpCallout_init( &ipbif_p->arprevco );
+	lanIpCallout_init( &ipbif_p->arpgarpco );
+
+#if IP_REASM_NENTRIES > 0
+	{
+	int i;
+	for ( i=0; i<IP_REASM_NENTRIES; i++ ) {
+		lanIpCallout_init( &ipbif_p->reasm[i].timo );
+		ipbif_p->reasm[i].pif = ipbif_p;
+	}
+	}
+#endif
 
 	if ( NETDRV_START(ipbif_p, 0) ) {
 		fprintf(stderr,"Unable to start driver\n");
@@ -3922,7 +6364,7 @@ IpBscIf           ipbif_p;
 		return 0;
 	}
 
-	if ( addmca(ipbif_p, MC_ALLSYS_SD, htonlc(IP_GRP_ALL_SYSTEMS)) ) {
+	if ( addmca(ipbif_p, MC_ALLSYS_SD, htonlc(IP_GRP_ALL_SYSTEMS), 0) ) {
 		fprintf(stderr,"Unable to add 224.0.0.1 MC group\n");
 		lanIpBscIfDestroy(ipbif_p);
 		return 0;
@@ -3933,6 +6375,11 @@ IpBscIf           ipbif_p;
 	 */
 	ipbif_p->mcallsys = ipbif_p->mclist.r_mcaddr;
 
+	arpSetAging( ipbif_p, ARP_AGE_MAXAGE, ARP_AGE_PROBE );
+
+	/* Let peers know where we are (e.g., after replacing hardware) */
+	arpAnnounce( ipbif_p, lanIpBscCfg.arp_garp_count, lanIpBscCfg.arp_garp_ival );
+
 	return ipbif_p;
 }
 
@@ -3977,6 +6424,17 @@ lanIpBscIfDestroy(IpBscIf pif)
 		 * here.
 		 */
 		lanIpCallout_stop( &pif->mcIgmpV1RtrSeen );
+		lanIpCallout_stop( &pif->mcIgmpV2RtrSeen );
+
+		/* Aging callout must not send probes anymore */
+		pif->arpmaxage = 0;
+		lanIpCallout_stop( &pif->arpageco );
+		/* ... and no revalidation requests or announcements either */
+		pif->arpgarpn = 0;
+		lanIpCallout_stop( &pif->arpgarpco );
+		lanIpCallout_stop( &pif->arprevco );
+		free( pif->arprevl );
+		pif->arprevl = 0;
 
 		if ( pif->drv_p ) {
 			if ( NETDRV_SHUTDOWN(pif->drv_p) ) {
@@ -3985,6 +6443,22 @@ lanIpBscIfDestroy(IpBscIf pif)
 			}
 		}
 
+		/* Driver is down; nobody can access the TX queues anymore */
+		txprio_flush( pif );
+		arpHoldFlush( pif );
+
+#if IP_REASM_NENTRIES > 0
+		/* ... nor add fragments */
+		{
+		int i;
+		for ( i=0; i<IP_REASM_NENTRIES; i++ ) {
+			lanIpCallout_stop( &pif->reasm[i].timo );
+			relrbuf( pif->reasm[i].frags );
+			pif->reasm[i].frags = 0;
+		}
+		}
+#endif
+
 		if ( pif->arpbuf )
 			relrbuf( pif->arpbuf );
 
@@ -3994,10 +6468,13 @@ lanIpBscIfDestroy(IpBscIf pif)
 		intrf = 0;
 
 		arpFlushCache(pif,1);
-		arp_destroyentry(arpcache(pif)[ARP_SENTINEL]);
-		arpcache(pif)[ARP_SENTINEL] = 0;
+		free( pif->arphtbl );
+		free( (void*)pif->arpseq );
+		free( (void*)pif->arpatime );
 
 		rtems_semaphore_delete(pif->mutx);
+		rtems_semaphore_delete(pif->txmutx);
+		rtems_semaphore_delete(pif->txwsem);
 		free(pif);
 	}
 	return 0;
@@ -4050,10 +6527,7 @@ int do_mc_loopback;
 
 	/* loop back locally subscribed multicast */
 	if ( do_mc_loopback ) {
-		pif->stats.ip_txmcloopback++;
-		/* all received bufs have the IF handle set... */
-		((rbuf_t*)buf_p)->buf.intrf = pif;
-		handleIP( (rbuf_t**)&buf_p, pif, 1 /* loopback */ );
+		mcLoopback( pif, (rbuf_t**)&buf_p );
 		if ( buf_p )
 			relrbuf( (rbuf_t *)buf_p );
 	}
@@ -4062,15 +6536,26 @@ int do_mc_loopback;
 
 /* Set/join multicast group on an interface (starting IGMP) and mark as used by
  * socket 'sd' (other than this marking the 'sd' has no meaning).
+ * If a source filter 'sf' is passed then it is attached to the membership of
+ * 'sd' (replacing the filter if 'sd' already is a member); 'sf' is consumed.
  */
 
 static int
-addmca(IpBscIf intrf, int sd, uint32_t mcaddr)
+addmca(IpBscIf intrf, int sd, uint32_t mcaddr, McSrcFilt sf)
 {
 IpBscMcAddr    mca, mcan;
 int            rval = 0;
 rtems_interval ticks_per_s;
 uint32_t       report_dly_ticks;
+unsigned       b;
+McSrcFilt      osf;
+int            replace = !!sf;
+
+	/* EXCLUDE {} is 'no filter' */
+	if ( sf && LANIP_MCAST_EXCLUDE == sf->mode && 0 == sf->nsrc ) {
+		free( sf );
+		sf = 0;
+	}
 
 	if ( ! (mcan = calloc(1, sizeof(*mcan))) ) {
 		return -ENOMEM;
@@ -4082,23 +6567,46 @@ uint32_t       report_dly_ticks;
 	MCLOCK( intrf );
 
 		if ( (mca = lhtblFind( intrf->mctable, mcaddr )) ) {
-			if ( (mca->mc_sobs & (1<<sd)) ) {
+			if ( (mca->mc_sobs & (1<<sd)) && ! replace ) {
 				rval =  -EADDRINUSE;
 				goto bail;
 			}
 			mca->mc_sobs |= (1<<sd);
+			if ( sd < NSOCKS ) {
+				osf            = mca->mc_sf[sd];
+				mca->mc_sf[sd] = sf;
+				sf             = osf;
+				/* membership or filter changed; update IF state */
+				mcsf_update( intrf, mca );
+			}
 		} else {
 			uint8_t enaddr[6];
 
 			mcan->mc_sobs = (1<<sd);
 
+			if ( sf ) {
+				mcan->mc_sf[sd] = sf;
+				mcan->mc_iff    = mcsf_merge( mcan );
+			}
+
 			ipmc2ethermc(mcaddr, enaddr);
 
 			if ( lhtblAdd( intrf->mctable, mcan ) ) {
+				mcan->mc_sf[sd] = 0;
+				free( mcan->mc_iff );
 				rval = -ENOMEM;
 				goto bail;
 			} 
 
+			if ( sf ) {
+				mcan->mc_flags |= MC_FLG_SRCFILT;
+				intrf->mcnsf++;
+				sf = 0;
+			}
+
+			b = mcprefbit( mcaddr );
+			intrf->mcpref[b >> 5] |= (1u << (b & 31));
+
 			NETDRV_MC_FILTER_ADD( intrf, enaddr );
 
 			c_enq( &intrf->mclist.r_node, &mcan->mc_node );
@@ -4107,10 +6615,15 @@ uint32_t       report_dly_ticks;
 
 				rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &ticks_per_s);
 
-				report_dly_ticks = 10 /* sec, 'unsolicited report interval' (RFC2236) */ * ticks_per_s;
+				if ( 3 == igmp_compat_version( intrf ) ) {
+					report_dly_ticks = 1 /* sec, 'unsolicited report interval' (RFC3376) */ * ticks_per_s;
+					mcan->mc_flags  |= MC_FLG_IGMP_CHG;
+				} else {
+					report_dly_ticks = 10 /* sec, 'unsolicited report interval' (RFC2236) */ * ticks_per_s;
+				}
 
 				/*
-				 * start IGMP (igmp_send_msg falls back to V1
+				 * start IGMP (igmp_send_msg falls back to V2/V1
 				 * if needed).
 				 */
 				igmp_send_msg(intrf, mcaddr, IGMP_TYPE_REPORT_V2);
@@ -4139,6 +6652,7 @@ bail:
 	MCUNLOCK( intrf );
 
 	free(mcan);
+	free(sf);
 
 	return rval;
 }
@@ -4167,6 +6681,11 @@ bail:
 static void
 destroymca(IpBscMcAddr mca)
 {
+int sd;
+
+	if ( ! mca )
+		return;
+
 	if ( lanIpCallout_failedstop( &mca->mc_igmp ) ) {
 		/* Callout couldn't be stopped by 'delmca()'; synchronize
 		 * with the callout task to make sure this callout
@@ -4178,6 +6697,10 @@ destroymca(IpBscMcAddr mca)
 
 	assert( ! lanIpCallout_active( &mca->mc_igmp ) );
 
+	for ( sd = 0; sd < NSOCKS; sd++ )
+		free( mca->mc_sf[sd] );
+	free( mca->mc_iff );
+
 	free(mca);
 }
 
@@ -4198,19 +6721,34 @@ destroymca(IpBscMcAddr mca)
 static IpBscMcAddr
 delmca(IpBscIf intrf, IpBscMcAddr mca, int sd)
 {
-uint8_t enaddr[6];
-int     lhtblDelFailedFatally;
+uint8_t     enaddr[6];
+int         lhtblDelFailedFatally;
+unsigned    b;
+IpBscMcAddr o;
+McSrcFilt   f;
 
 	if ( ! (mca->mc_sobs & (1<<sd)) )
 		return 0;
 
+	if ( sd < NSOCKS ) {
+		/* detach before freeing; the RX path may still look at it */
+		f              = mca->mc_sf[sd];
+		mca->mc_sf[sd] = 0;
+		free( f );
+	}
+
 	if ( 0 == (mca->mc_sobs &= ~ (1<<sd)) ) {
 
 		intrf->mcnum--;
 
+		if ( (MC_FLG_SRCFILT & mca->mc_flags) ) {
+			mca->mc_flags &= ~MC_FLG_SRCFILT;
+			intrf->mcnsf--;
+		}
+
 		if ( ! ISMCST_ALLSYS(mca->mc_addr) ) {
-			/* stop IGMP */
-			if ( (mca->mc_flags & MC_FLG_IGMP_LEAVE) ) {
+			/* stop IGMP (V3 has no report suppression; always leave) */
+			if ( (mca->mc_flags & MC_FLG_IGMP_LEAVE) || 3 == igmp_compat_version( intrf ) ) {
 				igmp_send_msg(intrf, mca->mc_addr, IGMP_TYPE_LEAVE);
 			}
 		}
@@ -4238,8 +6776,19 @@ int     lhtblDelFailedFatally;
 
 		assert( !lhtblDelFailedFatally );
 
+		/* Clear the prefilter bit unless another group maps to it */
+		b = mcprefbit( mca->mc_addr );
+		for ( o = intrf->mclist.r_mcaddr; o && mcprefbit( o->mc_addr ) != b; o = nxtmca(o) )
+			/* nothing else to do */;
+		if ( ! o )
+			intrf->mcpref[b >> 5] &= ~(1u << (b & 31));
+
 		return mca;
 	}
+
+	/* remaining members' filters determine the IF state now */
+	mcsf_update( intrf, mca );
+
 	return 0;	
 }
 
@@ -4334,11 +6883,140 @@ udpSockHdrsSetlen(LanUdpPkt p, int payload_len)
 	memset( & p->ip_part.ip.csum, 0, sizeof(p->ip_part.ip.csum) );
 #endif
 
-	p->ip_part.ip.csum  = in_cksum_hdr((void*)&p->ip_part.ip);
+	p->ip_part.ip.csum  = in_cksum_hdr((void*)&p->ip_part.ip);
+
+	p->udp.len      = htons(payload_len + sizeof(UdpHeaderRec));
+	p->udp.csum     = htonsc(0);
+}
+
+/* One's complement sum over the IP header (w/o options) but leaving out the
+ * length and checksum fields (i.e., the part which doesn't change from one
+ * packet to the next). Result is not folded.
+ */
+static inline uint32_t
+ipHdrCsumPartial(IpHeaderRec *ip)
+{
+uint16_a_t *p = (uint16_a_t*)ip;
+uint32_t    s = 0;
+int         i;
+
+	for ( i=0; i<sizeof(*ip)/sizeof(*p); i++ )
+		s += p[i];
+
+	return s - ip->len - ip->csum;
+}
+
+/* Add (remove) destination IP address to (from) a partial IP header sum; the
+ * socket header's partial leaves the destination out since 'sendto' changes it.
+ */
+static inline uint32_t
+ipHdrCsumAddDst(uint32_t partial, uint32_t dst)
+{
+	return partial + (dst & 0xffff) + (dst >> 16);
+}
+
+static inline uint32_t
+ipHdrCsumSubDst(uint32_t partial, uint32_t dst)
+{
+	return partial - (dst & 0xffff) - (dst >> 16);
+}
+
+/* Same as udpSockHdrsSetlen() but use precomputed partial sum of the IP header
+ * (see ipHdrCsumPartial()) instead of summing the entire header. Since only
+ * the length changes this amounts to an incremental update (RFC 1624).
+ */
+static inline void
+udpSockHdrsSetlenPartial(LanUdpPkt p, int payload_len, uint32_t partial)
+{
+	p->ip_part.ip.len   = htons(payload_len + sizeof(UdpHeaderRec) + sizeof(IpHeaderRec));
+
+	partial += p->ip_part.ip.len;
+	partial  = (partial & 0xffff) + (partial >> 16);
+	partial += partial >> 16;
+
+	p->ip_part.ip.csum  = ~partial & 0xffff;
+
+	p->udp.len      = htons(payload_len + sizeof(UdpHeaderRec));
+	p->udp.csum     = htonsc(0);
+}
+
+void
+udpSockHdrsSetlenDst(LanUdpPkt p, int payload_len, uint32_t dipaddr)
+{
+uint32_t partial;
+
+	partial = ipHdrCsumSubDst( ipHdrCsumPartial( &p->ip_part.ip ), p->ip_part.ip.dst );
+
+	p->ip_part.ip.dst = dipaddr;
+
+	udpSockHdrsSetlenPartial(p, payload_len, ipHdrCsumAddDst( partial, dipaddr ));
+}
+
+#if UDP_DSTCACHE_SZ > 0
+/* Per-socket cache of prebuilt headers for unconnected 'sendto'. Entries are
+ * keyed by destination IP address and port and hold the resolved MAC address
+ * along with the checksum partial. They are validated against the interface's
+ * ARP generation number (which is bumped whenever a MAC address is changed or
+ * removed from the ARP cache) and replaced in LRU order.
+ *
+ * NOTE: caller must hold the socket lock.
+ */
+static void
+udpDstCacheFlush(UdpSock s)
+{
+	memset( s->dcache, 0, sizeof(s->dcache) );
+	s->dcclock = 0;
+}
+
+static UdpDstCache
+udpDstCacheFind(UdpSock s, uint32_t ipaddr, uint16_t dport)
+{
+UdpDstCache e;
+int         i;
+
+	dport = htons(dport);
+
+	for ( i=0, e=s->dcache; i<UDP_DSTCACHE_SZ; i++, e++ ) {
+		if ( ipaddr == e->ipaddr && dport == e->dport ) {
+			if ( e->arpgen != s->intrf->arpgen ) {
+				/* stale; MAC address may have changed */
+				e->ipaddr = 0;
+				return 0;
+			}
+			e->lru = ++s->dcclock;
+			return e;
+		}
+	}
+	return 0;
+}
+
+/* Store header 'h' (destination MAC looked up while the IF's ARP generation
+ * was 'arpgen') in the cache, replacing the least recently used entry.
+ */
+static void
+udpDstCachePut(UdpSock s, LanUdpPkt h, uint32_t arpgen)
+{
+UdpDstCache e, v;
+int         i;
+
+	for ( i=1, v=e=s->dcache; i<UDP_DSTCACHE_SZ && v->ipaddr; i++ ) {
+		e++;
+		if ( ! e->ipaddr || (int32_t)(e->lru - v->lru) < 0 )
+			v = e;
+	}
 
-	p->udp.len      = htons(payload_len + sizeof(UdpHeaderRec));
-	p->udp.csum     = htonsc(0);
+	v->ipaddr = h->ip_part.ip.dst;
+	v->dport  = h->udp.dport;
+	v->arpgen = arpgen;
+	v->lru    = ++s->dcclock;
+	memcpy( &v->hdr, h, sizeof(v->hdr) );
+	v->csum   = ipHdrCsumPartial( &v->hdr.ip_part.ip );
 }
+#else
+#define udpDstCacheFlush(s)				do { } while (0)
+#define udpDstCacheFind(s, ipaddr, dport)	((UdpDstCache)0)
+#define udpDstCachePut(s, h, arpgen)		do { } while (0)
+#endif
 
 int
 udpSockHdrsInitFromIf(IpBscIf intrf, LanUdpPkt p, uint32_t dipaddr, uint16_t dport, uint16_t sport, uint16_t ip_id)
@@ -4473,8 +7151,14 @@ again:
 	socks[rval].flags  = 0;
 	socks[rval].nbytes = 0;
 	socks[rval].mclpbk = 1;
+	socks[rval].txprio = TXPRIO_DEFLT;
+	socks[rval].txtmo  = 0;
+	socks[rval].pcrate = 0;
+	socks[rval].txsq   = 0;
 
 	udpSockHdrsInitFromIf(intrf, &socks[rval].hdr, 0, 0, port, 0);
+	socks[rval].hcsum = ipHdrCsumPartial( &socks[rval].hdr.ip_part.ip ); /* dst is 0 */
+	udpDstCacheFlush( &socks[rval] );
 
 	q             = 0;
 	m             = 0;
@@ -4493,6 +7177,7 @@ udpSockDestroy(int sd)
 {
 rtems_id         q = 0;
 rtems_id         m = 0;
+rtems_id         sq = 0;
 IpBscMcAddr    mca, mcan;
 IpBscMcRef     junk;
 
@@ -4534,6 +7219,10 @@ IpBscMcRef     junk;
 			socks[sd].msgq = 0;
 			m = socks[sd].mutx;
 			socks[sd].mutx = 0;
+			sq = socks[sd].txsq;
+			socks[sd].txsq = 0;
+			/* invalidate tags still in flight */
+			socks[sd].gen++;
 			
 			nsocks--;
 		}
@@ -4547,6 +7236,9 @@ IpBscMcRef     junk;
 		destroymca(mca);
 	}
 
+	if ( sq )
+		rtems_message_queue_delete(sq);
+
 	if (q) {
 		/* drain queue */
 		UdpSockMsgRec msg;
@@ -4582,6 +7274,8 @@ int rval      = -1;
 
 	SOCKLOCK( & socks[sd] );
 
+	udpDstCacheFlush( &socks[sd] );
+
 	if ( 0 == dipaddr && 0 == dport ) {
 		/* disconnect */
 		if ( ! (FLG_ISCONN & socks[sd].flags) ) {
@@ -4605,6 +7299,9 @@ int rval      = -1;
 		}
 #endif
 
+		/* read before the lookup; a concurrent change invalidates the MAC */
+		socks[sd].arpgen = socks[sd].intrf->arpgen;
+
 		if ( (rval = udpSockHdrsInitFromIf(socks[sd].intrf, &socks[sd].hdr, dipaddr, dport, socks[sd].port, 0)) ) {
 			/* ARP lookup failure; BSD sockets probably would not
 			 * fail here...
@@ -4612,6 +7309,8 @@ int rval      = -1;
 			goto egress;
 		}
 
+		socks[sd].hcsum  = ipHdrCsumSubDst( ipHdrCsumPartial( &socks[sd].hdr.ip_part.ip ), dipaddr );
+
 		socks[sd].flags |= FLG_ISCONN;
 		if ( ISMCST(dipaddr) && (UDPSOCK_MCPASS & flags) ) {
 			socks[sd].flags |= FLG_MCPASS;
@@ -4707,21 +7406,221 @@ uint32_t maxes[20]={0};
 
 #endif
 
-int
-_udpSockSendTo_internal(int sd, LanIpPacket buf_p, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport)
+/* Token-bucket pacing. The bucket is refilled from the hwtimer; tokens are
+ * kept in units of bytes/hwtmr_hz so that no precision is lost. Since the
+ * (32-bit) hwtimer may wrap around the clock tick is used to measure long
+ * intervals.
+ */
+
+/* Ethernet, IP and UDP header bytes accounted for each datagram              */
+#define PACE_OVERHEAD	(14 + sizeof(IpHeaderRec) + sizeof(UdpHeaderRec))
+
+static uint32_t       hwtmr_hz = 0; /* hwtimer frequency (0: not calibrated)  */
+static rtems_interval pace_tps = 0; /* clock ticks per second                 */
+
+/* Measure the hwtimer frequency against the clock tick (takes ~100ms)        */
+static uint32_t
+hwtmrCalibrate()
+{
+rtems_interval n;
+uint32_t       t0;
+
+	if ( ! hwtmr_hz ) {
+		rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &pace_tps);
+		if ( ! (n = pace_tps / 10) )
+			n = 1;
+		/* synchronize with the tick */
+		rtems_task_wake_after( 1 );
+		t0 = Read_hwtimer();
+		rtems_task_wake_after( n );
+		hwtmr_hz = (uint32_t)( (uint64_t)(Read_hwtimer() - t0) * pace_tps / n );
+	}
+	return hwtmr_hz;
+}
+
+/* Refill the socket's bucket and debit 'nbytes'; the socket must be locked.
+ *
+ * RETURNS: time (us) the caller must wait before sending (0 if conforming).
+ */
+static uint32_t
+udpSockPace(UdpSock s, int nbytes)
+{
+uint32_t       now = Read_hwtimer();
+rtems_interval tck;
+int64_t        max = (int64_t)s->pcburst * hwtmr_hz;
+uint64_t       dt;
+uint32_t       dly;
+
+	rtems_clock_get(RTEMS_CLOCK_GET_TICKS_SINCE_BOOT, &tck);
+
+	if ( tck - s->pctck > pace_tps / 4 ) {
+		/* hwtimer may have wrapped around */
+		dt = (uint64_t)(tck - s->pctck) * (hwtmr_hz / pace_tps);
+	} else {
+		dt = (uint32_t)(now - s->pchwt);
+	}
+	s->pchwt = now;
+	s->pctck = tck;
+
+	if ( dt >= (uint64_t)(max - s->pctokens) / s->pcrate )
+		s->pctokens  = max;
+	else
+		s->pctokens += dt * s->pcrate;
+
+	s->pctokens -= (int64_t)nbytes * hwtmr_hz;
+
+	if ( s->pctokens >= 0 )
+		return 0;
+
+	/* deficit in hwtimer ticks -> us; round up */
+	dt  = (uint64_t)(-s->pctokens) / s->pcrate;
+	dly = (uint32_t)( (dt * 1000000 + hwtmr_hz - 1) / hwtmr_hz );
+
+	s->pcdelayed++;
+	s->pcsumdly += dly;
+	if ( dly > s->pcmaxdly )
+		s->pcmaxdly = dly;
+
+	return dly;
+}
+
+/* Copy 'iovcnt' segments into contiguous memory                             */
+static void
+iov_gather(void *dst, const struct iovec *iov, int iovcnt)
+{
+uint8_t *d = dst;
+int     i;
+
+	for ( i=0; i<iovcnt; i++ ) {
+		memcpy( d, iov[i].iov_base, iov[i].iov_len );
+		d += iov[i].iov_len;
+	}
+}
+
+/* Drivers which can't send out of arbitrary memory nor hold back packets
+ * may chain a header buffer to a payload buffer (NETDRV_ENQ_BUFFER_CHAIN()).
+ */
+#if defined(NETDRV_ENQ_BUFFER_CHAIN) && ! defined(NETDRV_SND_PACKET) && ! defined(NETDRV_TRY_ENQ_BUFFER)
+#define TX_CHAIN_SHARED
+#endif
+
+/* Such drivers may also send a header buffer followed by arbitrary memory
+ * (NETDRV_ENQ_BUFFER_REF()); region slices are then sent w/o copying.
+ */
+#if defined(NETDRV_ENQ_BUFFER_REF) && ! defined(NETDRV_SND_PACKET) && ! defined(NETDRV_TRY_ENQ_BUFFER)
+#define TX_REF_REGION
+#endif
+
+/* Allocate a tag which completes the region slice at 'ptr' (see
+ * udpSockSendRegion()).
+ *
+ * RETURNS: tag or 0 if all tags are in use.
+ */
+static unsigned
+txtag_alloc_region(IpBscIf pif, int sd, LanIpRegion rgn, void *ptr, int len)
+{
+unsigned tag;
+
+	if ( (tag = txtag_alloc( pif, sd, 0, len )) ) {
+		pif->txtags[tag - 1].nosts = 1;
+		pif->txtags[tag - 1].rptr  = ptr;
+		pif->txtags[tag - 1].rgn   = rgn;
+	} else {
+		pif->stats.udp_txstsdropped++;
+	}
+	return tag;
+}
+
+/* Build a complete frame for header 'h' (socket 'sd' locked) and park it until
+ * the destination is resolved (see arpHoldPkt()). The payload is taken from
+ * 'iov' or 'payload'; if a buffer 'buf_p' is passed then the payload is
+ * already there and the buffer is used for the frame.
+ *
+ * RETURNS: 'payload_len' or -errno; 'buf_p' is consumed in any case.
+ */
+static int
+udpSockHoldPkt(int sd, IpBscIf pif, LanUdpPkt h, LanIpPacket buf_p, void *payload, int payload_len, uint32_t *p_cookie, const struct iovec *iov, int iovcnt, LanIpRegion rgn)
+{
+unsigned tag = 0;
+
+	if ( payload_len > UDPPAYLOADSIZE ) {
+		/* fragmented datagrams are not held; just send a request */
+		arpLookup( pif, h->ip_part.ip.dst, 0, 0 );
+		relrbuf( (rbuf_t*)buf_p );
+		return -ENOTCONN;
+	}
+
+	if ( p_cookie ) {
+		if ( ! socks[sd].txsq ) {
+			relrbuf( (rbuf_t*)buf_p );
+			return -EINVAL;
+		}
+		if ( ! (tag = txtag_alloc( pif, sd, *p_cookie, payload_len )) ) {
+			pif->stats.udp_txstsdropped++;
+			relrbuf( (rbuf_t*)buf_p );
+			return -ENOBUFS;
+		}
+	} else if ( rgn ) {
+		/* the slice is copied but completes only once the copy is sent */
+		if ( ! (tag = txtag_alloc_region( pif, sd, rgn, payload, payload_len )) )
+			return -ENOBUFS;
+	}
+
+	if ( ! buf_p ) {
+		if ( ! (buf_p = (LanIpPacket)getrbuf()) ) {
+			txtag_free( pif, tag );
+			return -ENOBUFS;
+		}
+		if ( iov )
+			iov_gather( lpkt_udp_hdrs( buf_p ).pld, iov, iovcnt );
+		else
+			memcpy( lpkt_udp_hdrs( buf_p ).pld, payload, payload_len );
+	}
+
+	if ( h != &lpkt_udp_hdrs( buf_p ) )
+		memcpy( &lpkt_udp_hdrs( buf_p ), h, sizeof(*h) );
+
+	((rbuf_t*)buf_p)->buf.txtag = tag;
+
+	if ( arpHoldPkt( pif, h->ip_part.ip.dst, (rbuf_t*)buf_p, payload_len + sizeof(*h), socks[sd].txprio ) ) {
+		txtag_free( pif, tag );
+		relrbuf( (rbuf_t*)buf_p );
+		pif->stats.udp_txdropped++;
+		return -ENOBUFS;
+	}
+
+	return payload_len;
+}
+
+/* Send from socket 'sd'; if 'p_cookie' is non-NULL then the packet is tagged
+ * and its TX status reported to the socket's status queue.
+ * If 'iov' is non-NULL then the payload (of total size 'payload_len') is
+ * gathered from 'iovcnt' segments; this is only supported if the driver
+ * implements NETDRV_SND_PACKETV() (see udpSockSendV()).
+ * If 'shared' is non-NULL then 'payload' points into this buffer which is
+ * used by several packets; the driver may reference it (not consumed) but
+ * it must not be modified.
+ * If 'rgn' is non-NULL then 'payload' is a slice of this region which is
+ * completed by txstatus_post() (see udpSockSendRegion()).
+ */
+static int
+_udpSockSendTo_tagged(int sd, LanIpPacket buf_p, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport, uint32_t *p_cookie, const struct iovec *iov, int iovcnt, rbuf_t *shared, LanIpRegion rgn)
 {
 int          rval;
 LanUdpPkt    h;
 LanIpPart    ipp;
 int          do_mc_loopback = 0;
 IpBscIf      pif;
+UdpDstCache  dc;
+unsigned     tag = 0;
+uint32_t     t0  = 0;
+int          lat = 0;
+int          hold;
+#ifndef NETDRV_TX_STATUS
+int          drvsts = 0;
+#endif
 PRFDECL;
 
-	if ( payload_len > UDPPAYLOADSIZE ) {
-		rval = -EMSGSIZE;
-		goto bail;
-	}
-
 	if ( sd < 0 || sd >= NSOCKS ) {
 		rval = -EBADF;
 		goto bail;
@@ -4732,13 +7631,46 @@ PRFDECL;
 		goto bail;
 	}
 
+	/* Only plain copying sends on sockets which enabled it may be fragmented */
+	if ( payload_len > UDPPAYLOADSIZE
+#if IP_REASM_NENTRIES > 0
+	     && (   buf_p || iov || p_cookie || shared || rgn
+	         || ! (FLG_FRAG & socks[sd].flags)
+	         || payload_len > UDPFRAGPAYLOADSIZE )
+#endif
+	   ) {
+		rval = -EMSGSIZE;
+		goto bail;
+	}
+
+	/* Tokens are debited right away so that concurrent senders on
+	 * the same socket queue up behind each other.
+	 */
+	if ( socks[sd].pcrate ) {
+		uint32_t dly;
+		SOCKLOCK( &socks[sd] );
+			dly = socks[sd].pcrate ? udpSockPace( &socks[sd], payload_len + PACE_OVERHEAD ) : 0;
+		SOCKUNLOCK( &socks[sd] );
+		if ( dly )
+			rtems_task_wake_after( ((uint64_t)dly * pace_tps + 999999) / 1000000 );
+	}
+
+	/* pacing delay is deliberate and not accounted for */
+	/* Read_hwtimer() may legitimately return 0; don't use 't0' as a flag */
+	if ( (FLG_LATHIST & socks[sd].flags) ) {
+		lat = 1;
+		t0  = Read_hwtimer();
+	}
+
 	setbase();
 
 try_again:
 
 	SOCKLOCK( &socks[sd] );
 
-	pif = socks[sd].intrf;
+	pif  = socks[sd].intrf;
+	dc   = 0;
+	hold = 0;
 
 	dodiff(1);
 
@@ -4783,6 +7715,9 @@ try_again:
 
 				goto bail;
 			}
+		} else if ( (dc = udpDstCacheFind( &socks[sd], ipaddr, dport )) ) {
+			/* prebuilt header with valid MAC address */
+			memcpy( h, &dc->hdr, sizeof(*h) );
 		} else {
 			ipp->ip.dst  = ipaddr;
 			h->udp.dport = htons((unsigned short)dport);
@@ -4791,8 +7726,11 @@ try_again:
 
 	dodiff(3);
 
-	if ( ! (FLG_ISCONN & socks[sd].flags) ) {
-		uint8_t dummy[6];
+	if ( dc ) {
+		pif->stats.udp_dchit++;
+	} else if ( ! (FLG_ISCONN & socks[sd].flags) ) {
+		uint8_t  dummy[6];
+		uint32_t arpgen = pif->arpgen;
 
 		/* Doing a ARP lookup here prevents another task
 		 * sending on the same socket to a different destination
@@ -4806,6 +7744,12 @@ try_again:
 		 * do a slow lookup and start over
 		 */
 		if ( (rval = arpLookup(pif, ipp->ip.dst, ipp->ll.dst, 1)) ) {
+			if ( -ENOTCONN == rval && (FLG_ARPNOWAIT & socks[sd].flags) ) {
+				/* park the packet instead of waiting */
+				hold = 1;
+				goto resolved;
+			}
+
 			SOCKUNLOCK( &socks[sd] );
 
 			if ( -ENOTCONN != rval ) {
@@ -4822,114 +7766,467 @@ try_again:
 			 */
 			goto try_again;
 		}
-	} else {
-		if ( (rval = arpLookup(pif, ipp->ip.dst, ipp->ll.dst, 0)) ) {
+
+		/* 'arpgen' was read before the lookup; if the MAC changes
+		 * in the meantime the entry is stale from the start.
+		 */
+		pif->stats.udp_dcmiss++;
+		udpDstCachePut( &socks[sd], h, arpgen );
+	} else if ( socks[sd].arpgen != pif->arpgen ) {
+		/* The peer's MAC was resolved at connect time; look it up
+		 * again only if the ARP cache changed since.
+		 */
+		uint32_t arpgen = pif->arpgen;
+		int      nowait = (FLG_ARPNOWAIT & socks[sd].flags);
+		/* Update the socket's header ('h' may be a copy in the user's
+		 * buffer) so that the new generation covers it.
+		 */
+		if ( (rval = arpLookup(pif, ipp->ip.dst, socks[sd].hdr.ip_part.ll.dst, nowait)) ) {
+			if ( -ENOTCONN == rval && nowait ) {
+				hold = 1;
+				goto resolved;
+			}
 			SOCKUNLOCK( &socks[sd] );
 			goto bail;
 		}
+		if ( h != &socks[sd].hdr )
+			memcpy( ipp->ll.dst, socks[sd].hdr.ip_part.ll.dst, sizeof(ipp->ll.dst) );
+		socks[sd].arpgen = arpgen;
 	}
 
+resolved:
 	dodiff(4);
 
-	udpSockHdrsSetlen(h, payload_len);
+	/* Only the length (and for 'sendto' the destination) differ from
+	 * what the checksum partials were computed for.
+	 */
+	if ( dc )
+		udpSockHdrsSetlenPartial(h, payload_len, dc->csum);
+	else
+		udpSockHdrsSetlenPartial(h, payload_len, ipHdrCsumAddDst( socks[sd].hcsum, ipp->ip.dst ));
 
 	dodiff(5);
 
+	if ( hold ) {
+		rval = udpSockHoldPkt( sd, pif, h, buf_p, payload, payload_len, p_cookie, iov, iovcnt, rgn );
+		SOCKUNLOCK( &socks[sd] );
+		return rval;
+	}
+
+#if IP_REASM_NENTRIES > 0
+	if ( payload_len > UDPPAYLOADSIZE ) {
+		/* fragmented datagrams are not looped back */
+		rval = ipFragSend( pif, sd, h, payload, payload_len );
+		goto sent;
+	}
+#endif
+
 	do_mc_loopback = socks[sd].mclpbk && mcListener( pif, ipp->ip.dst );
 
+	if ( p_cookie ) {
+		if ( ! socks[sd].txsq ) {
+			SOCKUNLOCK( &socks[sd] );
+			rval = -EINVAL;
+			goto bail;
+		}
+		if ( ! (tag = txtag_alloc( pif, sd, *p_cookie, payload_len )) ) {
+			pif->stats.udp_txstsdropped++;
+			SOCKUNLOCK( &socks[sd] );
+			rval = -ENOBUFS;
+			goto bail;
+		}
+	} else if ( rgn ) {
+		if ( ! (tag = txtag_alloc_region( pif, sd, rgn, payload, payload_len )) ) {
+			SOCKUNLOCK( &socks[sd] );
+			rval = -ENOBUFS;
+			goto bail;
+		}
+	} else if ( lat ) {
+		/* need a tag to learn about completion; if none is available
+		 * then the packet goes out anyways.
+		 */
+		if ( ! (tag = txtag_alloc_lat( pif, sd, payload_len )) )
+			socks[sd].lat.nocmp++;
+	}
+	if ( tag && lat ) {
+		pif->txtags[tag - 1].lat = 1;
+		pif->txtags[tag - 1].t0  = t0;
+	}
+
 #ifdef NETDRV_SND_PACKET
 	if ( buf_p )
 		payload = lpkt_udp_hdrs( buf_p ).pld;
-	rval = NETDRV_SND_PACKET( pif, h, sizeof(*h), payload, payload_len );
+	/* Don't overtake packets that are held back in the TX queues */
+	if ( ! TXPRIO_IDLE( pif ) )
+		rval = -ENOSPC;
+#ifdef NETDRV_SND_PACKETV
+	else if ( iov )
+		rval = NETDRV_SND_PACKETV( pif, h, sizeof(*h), iov, iovcnt, payload_len, tag );
+#endif
+	else
+		rval = NETDRV_SND_PACKET( pif, h, sizeof(*h), payload, payload_len, tag );
 #endif
 
 	if ( ! buf_p ) {
 #ifdef NETDRV_SND_PACKET
-		if ( do_mc_loopback )
+		if ( do_mc_loopback || TXPRIO_ENQ( rval ) )
 #endif
 		{
 			if ( ! (buf_p = (LanIpPacket)getrbuf()) ) {
+				txtag_free( pif, tag );
 				SOCKUNLOCK( &socks[sd] );
 				rval = -ENOBUFS;
 				goto bail;
 			}
 			memcpy( &lpkt_udp_hdrs( buf_p ), h, sizeof(*h) );
-			memcpy(  lpkt_udp_hdrs( buf_p ).pld,  payload, payload_len );
+			if ( iov )
+				iov_gather( lpkt_udp_hdrs( buf_p ).pld, iov, iovcnt );
+#ifdef TX_CHAIN_SHARED
+			else if ( shared && ! do_mc_loopback )
+				; /* header buffer is chained to the payload */
+#endif
+#ifdef TX_REF_REGION
+			else if ( rgn && ! do_mc_loopback )
+				; /* header buffer references the region */
+#endif
+			else
+				memcpy(  lpkt_udp_hdrs( buf_p ).pld,  payload, payload_len );
 		}
 	}
 #ifdef NETDRV_SND_PACKET
 	else {
-		if ( ! do_mc_loopback )
+		if ( do_mc_loopback || TXPRIO_ENQ( rval ) ) {
+			/* header was sent from the socket; buffer needs its own copy */
+			memcpy( &lpkt_udp_hdrs( buf_p ), h, sizeof(*h) );
+		} else {
 			relrbuf( (rbuf_t*) buf_p );
+		}
 	}
 #endif
 
 	dodiff(6);
 
-#ifndef NETDRV_SND_PACKET
+#ifdef NETDRV_SND_PACKET
+	if ( TXPRIO_ENQ( rval ) ) {
+#endif
+#ifdef NETDRV_TX_STATUS
+	((rbuf_t*)buf_p)->buf.txtag = tag;
+#endif
 	if ( do_mc_loopback )
 		refrbuf( (rbuf_t*) buf_p );
+#ifdef NETDRV_TRY_ENQ_BUFFER
+	if ( (rval = txprio_send( pif, socks[sd].txprio, (rbuf_t*)buf_p, payload_len + sizeof(*h), socks[sd].txtmo )) > 0 )
+		rval = payload_len;
+#else
 	rval = payload_len;
+#ifdef TX_CHAIN_SHARED
+	if ( shared && ! do_mc_loopback ) {
+		refrbuf( shared );
+		NETDRV_ENQ_BUFFER_CHAIN( pif, (rbuf_t*)buf_p, sizeof(*h), shared, payload_len );
+	} else
+#endif
+#ifdef TX_REF_REGION
+	if ( rgn && ! do_mc_loopback ) {
+		/* driver reports once it no longer references the slice */
+		((rbuf_t*)buf_p)->buf.txtag = tag;
+#ifndef NETDRV_TX_STATUS
+		drvsts = 1;
+#endif
+		NETDRV_ENQ_BUFFER_REF( pif, (rbuf_t*)buf_p, sizeof(*h), payload, payload_len );
+	} else
+#endif
 	NETDRV_ENQ_BUFFER( pif, (rbuf_t*)buf_p, payload_len + sizeof(*h) );
 #endif
+#ifdef NETDRV_SND_PACKET
+	}
+#endif
 
+#if IP_REASM_NENTRIES > 0
+sent:
+#endif
 	if ( rval > 0 ) {
 		pif->stats.udp_txfrm++;
 		pif->stats.udp_txbytes += rval;
+		if ( lat )
+			lathist_add( socks[sd].lat.acc, &socks[sd].lat.accmax, Read_hwtimer() - t0 );
+#ifndef NETDRV_TX_STATUS
+		/* driver doesn't report; the packet is done as far as we can tell */
+		if ( ! drvsts )
+			txstatus_post( pif, tag, 0 );
+#endif
 	} else {
+		/* driver never got the packet */
+		txtag_free( pif, tag );
 		pif->stats.udp_txdropped++;
 	}
 
-	dodiff(7);
+	dodiff(7);
+
+	/* loop back locally subscribed multicast ? */
+	if ( do_mc_loopback ) {
+		mcLoopback( pif, (rbuf_t**)&buf_p );
+		if ( buf_p )
+			relrbuf( (rbuf_t *)buf_p );
+	}
+
+	dodiff(8);
+
+	SOCKUNLOCK( &socks[sd] );
+	
+	dodiff(9);
+
+	return rval;
+
+bail:
+	relrbuf((rbuf_t*)buf_p);
+	return rval;
+}
+
+int
+_udpSockSendTo_internal(int sd, LanIpPacket buf_p, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport)
+{
+	return _udpSockSendTo_tagged(sd, buf_p, payload, payload_len, ipaddr, dport, 0, 0, 0, 0, 0);
+}
+
+int
+udpSockSendTagged(int sd, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport, uint32_t cookie)
+{
+	return _udpSockSendTo_tagged(sd, 0, payload, payload_len, ipaddr, dport, &cookie, 0, 0, 0, 0);
+}
+
+int
+udpSockSetTxStatusQueue(int sd, int depth)
+{
+rtems_id q = 0;
+rtems_id o;
+
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+	if ( depth > 0 ) {
+		if ( RTEMS_SUCCESSFUL != rtems_message_queue_create(
+				rtems_build_name('u','d','p','s'),
+				depth,
+				sizeof(UdpSockTxStatusRec),
+				RTEMS_FIFO | RTEMS_LOCAL,
+				&q) ) {
+			return -ENOSPC;
+		}
+	}
+
+	SOCKLOCK( &socks[sd] );
+		o               = socks[sd].txsq;
+		socks[sd].txsq  = q;
+	SOCKUNLOCK( &socks[sd] );
+
+	if ( o )
+		rtems_message_queue_delete( o );
+
+	return 0;
+}
+
+int
+udpSockGetTxStatus(int sd, UdpSockTxStatus p_sts, int timeout_ticks)
+{
+size_t            sz = sizeof(*p_sts);
+rtems_id          q;
+rtems_status_code sc;
+
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( ! (q = socks[sd].txsq) )
+		return -EINVAL;
+
+	sc = rtems_message_queue_receive(
+			q,
+			p_sts,
+			&sz,
+			timeout_ticks ? RTEMS_WAIT : RTEMS_NO_WAIT,
+			timeout_ticks < 0 ? RTEMS_NO_TIMEOUT : timeout_ticks);
+
+	switch ( sc ) {
+		case RTEMS_SUCCESSFUL:  return 0;
+		case RTEMS_UNSATISFIED: return -EAGAIN;
+		case RTEMS_TIMEOUT:     return -ETIMEDOUT;
+		default:                break;
+	}
+	return -EBADF;
+}
+
+int
+udpSockSend(int sd, void *payload, int payload_len)
+{
+	return _udpSockSendTo_internal(sd, 0, payload, payload_len, 0, 0);
+}
+
+
+int
+udpSockSendTo(int sd, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport)
+{
+	return _udpSockSendTo_internal(sd, 0, payload, payload_len, ipaddr, dport);
+}
+
+int
+udpSockSendBuf(int sd, LanIpPacket b, int payload_len)
+{
+	return _udpSockSendTo_internal(sd, b, 0, payload_len, 0, 0);
+}
+
+int
+udpSockSendBufTo(int sd, LanIpPacket b, int payload_len, uint32_t ipaddr, uint16_t dport)
+{
+	return _udpSockSendTo_internal(sd, b, 0, payload_len, ipaddr, dport);
+}
+
+int
+udpSockSendV(int sd, const struct iovec *iov, int iovcnt)
+{
+int len = 0;
+int i;
+#ifndef NETDRV_SND_PACKETV
+rbuf_t *b;
+#endif
+
+	if ( ! iov || iovcnt < 0 )
+		return -EINVAL;
+
+	for ( i=0; i<iovcnt; i++ ) {
+		if ( iov[i].iov_len > UDPPAYLOADSIZE )
+			return -EMSGSIZE;
+		len += iov[i].iov_len;
+	}
+
+	if ( len > UDPPAYLOADSIZE )
+		return -EMSGSIZE;
+
+#ifdef NETDRV_SND_PACKETV
+	return _udpSockSendTo_tagged(sd, 0, 0, len, 0, 0, 0, iov, iovcnt, 0, 0);
+#else
+	/* driver can't gather; copy into a buffer */
+	if ( ! (b = getrbuf()) )
+		return -ENOBUFS;
+
+	iov_gather( lpkt_udp_hdrs( &b->pkt ).pld, iov, iovcnt );
+
+	return _udpSockSendTo_internal(sd, &b->pkt, 0, len, 0, 0);
+#endif
+}
 
-	/* loop back locally subscribed multicast ? */
-	if ( do_mc_loopback ) {
-		pif->stats.ip_txmcloopback++;
-		/* all received bufs have the IF handle set... */
-		((rbuf_t*)buf_p)->buf.intrf = pif;
-		handleIP( (rbuf_t**)&buf_p, pif, 1 /* loopback */ );
-		if ( buf_p )
-			relrbuf( (rbuf_t *)buf_p );
+/* The payload buffer is shared by all packets: drivers with a FIFO
+ * gather it (NETDRV_SND_PACKET), drivers which chain buffers reference it
+ * (NETDRV_ENQ_BUFFER_CHAIN) and all others copy it.
+ */
+int
+udpSockSendMulti(int sd, LanIpPacket b, int payload_len, const LanIpDestRec *dests, int n)
+{
+int i, st, rval = 0;
+
+	if ( sd < 0 || sd >= NSOCKS || 0 == socks[sd].port ) {
+		rval = -EBADF;
+		goto bail;
 	}
 
-	dodiff(8);
+	if ( n < 0 || (n > 0 && ! dests) ) {
+		rval = -EINVAL;
+		goto bail;
+	}
 
-	SOCKUNLOCK( &socks[sd] );
-	
-	dodiff(9);
+	if ( payload_len > UDPPAYLOADSIZE ) {
+		rval = -EMSGSIZE;
+		goto bail;
+	}
 
-	return rval;
+	for ( i=0; i<n; i++ ) {
+		st = _udpSockSendTo_tagged(sd, 0, lpkt_udp_hdrs( b ).pld, payload_len, dests[i].ipaddr, dests[i].dport, 0, 0, 0, (rbuf_t*)b, 0);
+		if ( st >= 0 ) {
+			rval++;
+		} else if ( -EBADF == st || -EISCONN == st ) {
+			/* no point trying the others */
+			if ( 0 == rval )
+				rval = st;
+			break;
+		}
+	}
 
 bail:
-	relrbuf((rbuf_t*)buf_p);
+	relrbuf((rbuf_t*)b);
 	return rval;
 }
 
-int
-udpSockSend(int sd, void *payload, int payload_len)
+LanIpRegion
+udpSockRegisterRegion(void *base, size_t size, LanIpRegionDoneProc done, void *closure)
 {
-	return _udpSockSendTo_internal(sd, 0, payload, payload_len, 0, 0);
-}
+LanIpRegion rgn;
 
+	if ( ! base || ! done )
+		return 0;
 
-int
-udpSockSendTo(int sd, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport)
-{
-	return _udpSockSendTo_internal(sd, 0, payload, payload_len, ipaddr, dport);
+	if ( (rgn = malloc(sizeof(*rgn))) ) {
+		rgn->base     = base;
+		rgn->size     = size;
+		rgn->done     = done;
+		rgn->closure  = closure;
+		rgn->inflight = 0;
+	}
+	return rgn;
 }
 
 int
-udpSockSendBuf(int sd, LanIpPacket b, int payload_len)
+udpSockUnregisterRegion(LanIpRegion rgn)
 {
-	return _udpSockSendTo_internal(sd, b, 0, payload_len, 0, 0);
+rtems_interrupt_level l;
+int                   busy;
+
+	rtems_interrupt_disable(l);
+		busy = rgn->inflight;
+		if ( ! busy )
+			rgn->size = 0; /* reject further sends */
+	rtems_interrupt_enable(l);
+
+	if ( busy )
+		return -EBUSY;
+
+	free(rgn);
+	return 0;
 }
 
+/* The slice travels with a TX tag; txstatus_post() completes it once the
+ * driver no longer references it (or the copy made of it has been sent).
+ */
 int
-udpSockSendBufTo(int sd, LanIpPacket b, int payload_len, uint32_t ipaddr, uint16_t dport)
+udpSockSendRegion(int sd, LanIpRegion rgn, void *ptr, int len, uint32_t ipaddr, uint16_t dport)
 {
-	return _udpSockSendTo_internal(sd, b, 0, payload_len, ipaddr, dport);
-}
+rtems_interrupt_level l;
+int                   rval;
+
+	if (   len <= 0
+		|| (uint8_t*)ptr < rgn->base
+		|| (uint8_t*)ptr + len > rgn->base + rgn->size )
+		return -EINVAL;
+
+#ifdef NETDRV_SND_PACKET
+	/* FIFO gather needs word-aligned data */
+	if ( ((uintptr_t)ptr & 3) )
+		return -EINVAL;
+#endif
+
+	rtems_interrupt_disable(l);
+		rgn->inflight++;
+	rtems_interrupt_enable(l);
+
+	if ( (rval = _udpSockSendTo_tagged(sd, 0, ptr, len, ipaddr, dport, 0, 0, 0, 0, rgn)) <= 0 ) {
+		/* never referenced; no callback */
+		rtems_interrupt_disable(l);
+			rgn->inflight--;
+		rtems_interrupt_enable(l);
+	}
 
+	return rval;
+}
 
 void
 udpSockFreeBuf(LanIpPacketRec *b)
@@ -4969,6 +8266,27 @@ udpSockGetBufIf(LanIpPacket buf_p)
 	return ((rbuf_t*)buf_p)->buf.intrf;
 }
 
+int
+udpSockBufSegs(LanIpPacket buf_p, struct iovec *iov, int iovcnt)
+{
+rbuf_t *p = (rbuf_t*)buf_p;
+int    n;
+
+	for ( n = 0; p; p = p->buf.frag, n++ ) {
+		if ( n >= iovcnt )
+			continue;
+		if ( 0 == n ) {
+			iov[n].iov_base = lpkt_udp_hdrs( &p->pkt ).pld;
+			iov[n].iov_len  = IPFRAG_LEN( &lpkt_ip( &p->pkt ) ) - sizeof(UdpHeaderRec);
+		} else {
+			/* payload of subsequent fragments starts right after the IP header */
+			iov[n].iov_base = &lpkt_udp_hdrs( &p->pkt ).udp;
+			iov[n].iov_len  = IPFRAG_LEN( &lpkt_ip( &p->pkt ) );
+		}
+	}
+	return n;
+}
+
 int
 udpSockSetIfMcast(int sd, uint32_t ifipaddr)
 {
@@ -5013,6 +8331,214 @@ int rval;
 	return rval;
 }
 
+int
+udpSockSetTxPriority(int sd, int prio)
+{
+int rval;
+
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( prio >= TXPRIO_NCLASSES )
+		return -EINVAL;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+	SOCKLOCK( & socks[sd] );
+
+	rval = socks[sd].txprio;
+	if ( prio >= 0 ) {
+		/* if prio < 0 they want to just read the current class */
+		socks[sd].txprio = prio;
+	}
+	SOCKUNLOCK( & socks[sd] );
+
+	return rval;
+}
+
+int
+udpSockSetTxTimeout(int sd, int timeout_ticks)
+{
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+	SOCKLOCK( & socks[sd] );
+		socks[sd].txtmo = timeout_ticks;
+	SOCKUNLOCK( & socks[sd] );
+
+	return 0;
+}
+
+int
+udpSockSetPacing(int sd, uint32_t rate, uint32_t burst)
+{
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+	if ( rate && ! hwtmrCalibrate() )
+		return -ENOTSUP;
+
+	/* bucket must hold at least one full-sized frame */
+	if ( burst < UDPPAYLOADSIZE + PACE_OVERHEAD )
+		burst = UDPPAYLOADSIZE + PACE_OVERHEAD;
+
+	SOCKLOCK( & socks[sd] );
+		socks[sd].pcrate    = rate;
+		socks[sd].pcburst   = burst;
+		/* start with a full bucket */
+		socks[sd].pctokens  = (int64_t)burst * hwtmr_hz;
+		socks[sd].pchwt     = Read_hwtimer();
+		rtems_clock_get(RTEMS_CLOCK_GET_TICKS_SINCE_BOOT, &socks[sd].pctck);
+		socks[sd].pcdelayed = 0;
+		socks[sd].pcmaxdly  = 0;
+		socks[sd].pcsumdly  = 0;
+	SOCKUNLOCK( & socks[sd] );
+
+	return 0;
+}
+
+int
+udpSockSetTxLatency(int sd, int enable)
+{
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+	if ( enable && ! hwtmrCalibrate() )
+		return -ENOTSUP;
+
+	SOCKLOCK( & socks[sd] );
+		memset( &socks[sd].lat, 0, sizeof(socks[sd].lat) );
+		if ( enable )
+			socks[sd].flags |=  FLG_LATHIST;
+		else
+			socks[sd].flags &= ~FLG_LATHIST;
+	SOCKUNLOCK( & socks[sd] );
+
+	return 0;
+}
+
+int
+udpSockSetArpNoWait(int sd, int enable)
+{
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+	SOCKLOCK( & socks[sd] );
+		if ( enable )
+			socks[sd].flags |=  FLG_ARPNOWAIT;
+		else
+			socks[sd].flags &= ~FLG_ARPNOWAIT;
+	SOCKUNLOCK( & socks[sd] );
+
+	return 0;
+}
+
+int
+udpSockResetTxLatency(int sd)
+{
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+	/* completions may still be counted while we clear; don't care */
+	SOCKLOCK( & socks[sd] );
+		memset( &socks[sd].lat, 0, sizeof(socks[sd].lat) );
+	SOCKUNLOCK( & socks[sd] );
+
+	return 0;
+}
+
+/* Convert hwtimer ticks to us                                               */
+static uint32_t
+hwtmr2us(uint64_t t)
+{
+	return hwtmr_hz ? (uint32_t)( t * 1000000 / hwtmr_hz ) : 0;
+}
+
+int
+udpSockDumpTxLatency(int sd, FILE *f)
+{
+UdpLatHistRec h;
+int           i, last;
+
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port || ! (FLG_LATHIST & socks[sd].flags) )
+		return -EBADF;
+
+	if ( ! f )
+		f = stdout;
+
+	/* take a snapshot so that we don't hold the lock while printing */
+	SOCKLOCK( & socks[sd] );
+		h = socks[sd].lat;
+	SOCKUNLOCK( & socks[sd] );
+
+	for ( i=last=0; i<UDP_LATHIST_NBINS; i++ ) {
+		if ( h.acc[i] || h.cmp[i] )
+			last = i;
+	}
+
+	fprintf(f, "TX latency of socket %i (port %i):\n", sd, socks[sd].port);
+	fprintf(f, "  Max.: %"PRIu32"us to driver, %"PRIu32"us to completion (%"PRIu32" not recorded)\n",
+		hwtmr2us(h.accmax), hwtmr2us(h.cmpmax), h.nocmp);
+	fprintf(f, "      < ticks  (~us)     Driver  Completed\n");
+	for ( i=0; i<=last; i++ ) {
+		if ( i == UDP_LATHIST_NBINS - 1 )
+			fprintf(f, "  %11s %6s  %9"PRIu32"  %9"PRIu32"\n", "more", "", h.acc[i], h.cmp[i]);
+		else
+			fprintf(f, "  %11"PRIu32" %6"PRIu32"  %9"PRIu32"  %9"PRIu32"\n",
+				(uint32_t)1 << i, hwtmr2us( (uint64_t)1 << i ), h.acc[i], h.cmp[i]);
+	}
+	return 0;
+}
+
+int
+udpSockSetFragmentation(int sd, int enable)
+{
+int rval;
+
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+#if IP_REASM_NENTRIES > 0
+	SOCKLOCK( & socks[sd] );
+
+	rval = (FLG_FRAG & socks[sd].flags) ? 1 : 0;
+	if ( enable > 0 ) {
+		socks[sd].flags |= FLG_FRAG;
+	} else if ( 0 == enable ) {
+		socks[sd].flags &= ~FLG_FRAG;
+	}
+	/* if enable < 0 they want to just read the current state */
+
+	SOCKUNLOCK( & socks[sd] );
+#else
+	rval = enable > 0 ? -ENOTSUP : 0;
+#endif
+
+	return rval;
+}
+
 int
 udpSockJoinMcast(int sd, uint32_t mcaddr)
 {
@@ -5025,7 +8551,40 @@ udpSockJoinMcast(int sd, uint32_t mcaddr)
 	if ( 0 == socks[sd].port )
 		return -EBADF;
 
-	return addmca( socks[sd].intrf, sd, mcaddr );
+	return addmca( socks[sd].intrf, sd, mcaddr, 0 );
+}
+
+int
+udpSockJoinMcastSrc(int sd, uint32_t mcaddr, int mode, const uint32_t *srcs, unsigned nsrcs)
+{
+McSrcFilt sf;
+
+	if ( ! ISMCST( mcaddr ) )
+		return -EINVAL;
+
+	if ( LANIP_MCAST_INCLUDE != mode && LANIP_MCAST_EXCLUDE != mode )
+		return -EINVAL;
+
+	/* INCLUDE {} means 'not a member'; use udpSockLeaveMcast() */
+	if ( ( LANIP_MCAST_INCLUDE == mode && 0 == nsrcs ) || nsrcs > MC_SRCFILT_MAX || ( nsrcs && ! srcs ) )
+		return -EINVAL;
+
+	if ( sd < 0 || sd >= NSOCKS )
+		return -EBADF;
+
+	if ( 0 == socks[sd].port )
+		return -EBADF;
+
+	if ( ! (sf = malloc( sizeof(*sf) + nsrcs * sizeof(sf->srcs[0]) )) )
+		return -ENOMEM;
+
+	sf->mode = mode;
+	sf->nsrc = nsrcs;
+	if ( nsrcs )
+		memcpy( sf->srcs, srcs, nsrcs * sizeof(sf->srcs[0]) );
+	mcsf_sort( sf );
+
+	return addmca( socks[sd].intrf, sd, mcaddr, sf );
 }
 
 int
@@ -5080,6 +8639,9 @@ lanIpBscInit()
 	if ( ! lanIpCallout_initialize() )
 		goto bail;
 
+	if ( arp_sem_pool_create( lanIpBscCfg.arp_nsems ) )
+		fprintf(stderr,"lanIpBscInit(): ARP semaphore pool incomplete (%u/%u)\n", arpSemAvail, lanIpBscCfg.arp_nsems);
+
 	return 0;
 
 bail:
@@ -5122,6 +8684,8 @@ task_killer           killer;
 
 	lanIpCallout_finalize();
 
+	arp_sem_pool_destroy();
+
 	freeBufMem();
 
 	return 0;
@@ -5159,6 +8723,21 @@ lanIpBscConfig(LanIpBscConfig p_cfg, LanIpBscConfig p_oldcfg)
 		if ( (LANIPCFG_SQDEPTH & p_cfg->mask) ) {
 			lanIpBscCfg.rx_queue_depth = p_cfg->rx_queue_depth;
 		}
+
+		if ( (LANIPCFG_ARPNSEM & p_cfg->mask) ) {
+			lanIpBscCfg.arp_nsems = p_cfg->arp_nsems;
+		}
+
+		if ( (LANIPCFG_ARPCSZ & p_cfg->mask) ) {
+			if ( p_cfg->arp_cache_size > (1<<20) )
+				return -EINVAL;
+			lanIpBscCfg.arp_cache_size = p_cfg->arp_cache_size;
+		}
+
+		if ( (LANIPCFG_GARP & p_cfg->mask) ) {
+			lanIpBscCfg.arp_garp_count = p_cfg->arp_garp_count;
+			lanIpBscCfg.arp_garp_ival  = p_cfg->arp_garp_ival;
+		}
 	}
 
 	return 0;
@@ -5183,6 +8762,14 @@ lanIpBscDumpConfig(FILE *f)
 		lanIpBscCfg.tx_ring_size);
 	fprintf(f,"Socket RX queue depth:                 %6u\n",
 		lanIpBscCfg.rx_queue_depth);
+	fprintf(f,"ARP cache size (slots):                %6u\n",
+		lanIpBscCfg.arp_cache_size);
+	fprintf(f,"ARP sync sems: Free %6u,              Total %6u\n",
+		arpSemAvail,
+		lanIpBscCfg.arp_nsems);
+	fprintf(f,"Gratuitous ARPs on IF creation: %6u, Interval %6ums\n",
+		lanIpBscCfg.arp_garp_count,
+		lanIpBscCfg.arp_garp_ival);
 }
 
 void
@@ -5226,7 +8813,13 @@ uint32_t tmp;
 		fprintf(f," # Dropped Frames:\n");
 		fprintf(f,"    Address Mismatch:        %9"PRIu32"\n", intrf->stats.ip_dstdropped);
 		fprintf(f,"    Soft Multicast Filter:   %9"PRIu32"\n", intrf->stats.ip_mcdstdropped);
+		fprintf(f,"    Multicast Source Filter: %9"PRIu32"\n", intrf->stats.ip_mcsrcdropped);
 		fprintf(f,"    Fragmented:              %9"PRIu32"\n", intrf->stats.ip_frgdropped);
+		fprintf(f,"    Reassembly failed:       %9"PRIu32"\n", intrf->stats.ip_reasmdropped);
+		fprintf(f,"    Reassembly timed out:    %9"PRIu32"\n", intrf->stats.ip_reasmtimo);
+		fprintf(f," # Fragments Accepted:       %9"PRIu32"\n", intrf->stats.ip_rxfrag);
+		fprintf(f," # Datagrams Reassembled:    %9"PRIu32"\n", intrf->stats.ip_reasmok);
+		fprintf(f," # Fragments Sent:           %9"PRIu32"\n", intrf->stats.ip_txfrag);
 		fprintf(f,"    Too Big:                 %9"PRIu32"\n", intrf->stats.ip_lendropped);
 		fprintf(f,"    Unsupported Protocol:    %9"PRIu32"\n", intrf->stats.ip_protdropped);
 		fprintf(f," # Multicast Loopback:       %9"PRIu32"\n", intrf->stats.ip_txmcloopback);
@@ -5243,6 +8836,38 @@ uint32_t tmp;
 		fprintf(f," # Frames Sent:              %9"PRIu32"\n", intrf->stats.udp_txfrm);
 		fprintf(f," # Bytes Sent:               %9"PRIu32"\n", intrf->stats.udp_txbytes);
 		fprintf(f," # Frames Dropped (TX):      %9"PRIu32"\n", intrf->stats.udp_txdropped);
+		fprintf(f," # Sendto Hdr. Cache Hits:   %9"PRIu32"\n", intrf->stats.udp_dchit);
+		fprintf(f," # Sendto Hdr. Cache Misses: %9"PRIu32"\n", intrf->stats.udp_dcmiss);
+		fprintf(f," # TX Status Reports:        %9"PRIu32"\n", intrf->stats.udp_txsts);
+		fprintf(f,"    Reporting Errors:        %9"PRIu32"\n", intrf->stats.udp_txstserr);
+		fprintf(f,"    Lost (queue full/no tag):%9"PRIu32"\n", intrf->stats.udp_txstsdropped);
+		{
+		int i;
+		for ( i=0; i<NSOCKS; i++ ) {
+			UdpSock s = &socks[i];
+			if ( s->port && s->intrf == intrf && s->pcrate ) {
+				fprintf(f," Paced socket %i (%"PRIu32" bytes/s, burst %"PRIu32"):\n", i, s->pcrate, s->pcburst);
+				fprintf(f,"    Sends delayed:           %9"PRIu32"\n", s->pcdelayed);
+				fprintf(f,"    Max. delay (us):         %9"PRIu32"\n", s->pcmaxdly);
+				fprintf(f,"    Avg. delay (us):         %9"PRIu32"\n",
+					s->pcdelayed ? (uint32_t)(s->pcsumdly/s->pcdelayed) : 0);
+			}
+		}
+		}
+#ifdef NETDRV_TRY_ENQ_BUFFER
+		{
+		int     i;
+		TxPrioQ q;
+		fprintf(f," TX Priority Classes (delays in hwtimer ticks):\n");
+		fprintf(f,"  Class       Sent       Held    Dropped    Blocked Queued  Max Delay  Avg Delay\n");
+		for ( i=0; i<TXPRIO_NCLASSES; i++ ) {
+			q = &intrf->txq[i];
+			fprintf(f,"  %5u  %9"PRIu32"  %9"PRIu32"  %9"PRIu32"  %9"PRIu32" %6u  %9"PRIu32"  %9"PRIu32"\n",
+				i, q->txfrm, q->held, q->dropped, q->blocked, q->nbufs, q->maxdly,
+				q->txfrm ? (uint32_t)(q->sumdly/q->txfrm) : 0);
+		}
+		}
+#endif
 	}
 	if ( (IPBSC_IFSTAT_INFO_ARP & info ) ) {
 		fprintf(f,"ARP statistics:\n");
@@ -5253,6 +8878,28 @@ uint32_t tmp;
 		fprintf(f,"    Unsup. Len. or Operation:%9"PRIu32"\n", intrf->stats.arp_lenopdropped);
 		fprintf(f,"    Unsup. Protocol:         %9"PRIu32"\n", intrf->stats.arp_protdropped);
 		fprintf(f," Failures to Create Sema:    %9"PRIu32"\n", intrf->stats.arp_nosem);
+		fprintf(f," Sema Created (Pool empty):  %9"PRIu32"\n", intrf->stats.arp_semdyn);
+		fprintf(f," Cache Slots:                %9i\n",         arpcachesz(intrf));
+		fprintf(f," # Entries Evicted (LRU):    %9"PRIu32"\n", intrf->stats.arp_evicted);
+		fprintf(f," # No Slot Available:        %9"PRIu32"\n", intrf->stats.arp_nospc);
+		fprintf(f," # Lookups w/o Locking:      %9"PRIu32"\n", intrf->stats.arp_lkfast);
+		fprintf(f," # Lookups Locked:           %9"PRIu32"\n", intrf->stats.arp_lklocked);
+		fprintf(f," # Packets Held for Reply:   %9"PRIu32"\n", intrf->stats.arp_held);
+		fprintf(f,"    Sent after Reply:        %9"PRIu32"\n", intrf->stats.arp_holdsent);
+		fprintf(f,"    Dropped (no Reply):      %9"PRIu32"\n", intrf->stats.arp_holdtimo);
+		fprintf(f,"    Dropped (Queue full):    %9"PRIu32"\n", intrf->stats.arp_holddropped);
+		fprintf(f,"    Currently held:          %9u\n",          intrf->arpnhold);
+		if ( intrf->arpmaxage ) {
+		fprintf(f," Aging: max. age %"PRIu32"s, probing %"PRIu32"s before expiry\n",
+			intrf->arpmaxage, intrf->arpprobe);
+		}
+		fprintf(f," # Entries Expired (Aging):  %9"PRIu32"\n", intrf->stats.arp_aged);
+		fprintf(f," # Unicast Probes Sent:      %9"PRIu32"\n", intrf->stats.arp_probes);
+		fprintf(f," # RX Refreshes Scheduled:   %9"PRIu32"\n", intrf->stats.arp_rfsched);
+		fprintf(f," # RX Refreshes Skipped:     %9"PRIu32"\n", intrf->stats.arp_rfskipped);
+		fprintf(f," # Entries Loaded:           %9"PRIu32"\n", intrf->stats.arp_loaded);
+		fprintf(f," # Revalidation Requests:    %9"PRIu32"\n", intrf->stats.arp_reval);
+		fprintf(f," # Gratuitous ARPs Sent:     %9"PRIu32"\n", intrf->stats.arp_garp);
 		fprintf(f," # Requests Sent:            %9"PRIu32"\n", intrf->stats.arp_txreq);
 		fprintf(f," # Replies Sent:             %9"PRIu32"\n", intrf->stats.arp_txrep);
 		fprintf(f," ARP Cache Dump:\n");
@@ -5272,12 +8919,15 @@ uint32_t tmp;
 		fprintf(f," # V2 Reports Received:      %9"PRIu32"\n", intrf->stats.igmp_rxreportv2);
 		fprintf(f," # V1 Queries Received:      %9"PRIu32"\n", intrf->stats.igmp_rxqueryv1);
 		fprintf(f," # V2 Queries Received:      %9"PRIu32"\n", intrf->stats.igmp_rxqueryv2);
+		fprintf(f," # V3 Queries Received:      %9"PRIu32"\n", intrf->stats.igmp_rxqueryv3);
 		fprintf(f," # Frames Dropped:\n");
 		fprintf(f,"    Unsup. IP Header:        %9"PRIu32"\n", intrf->stats.igmp_hdrdropped);
 		fprintf(f,"    Unsup. Length:           %9"PRIu32"\n", intrf->stats.igmp_lendropped);
 		fprintf(f,"    Bad Checksum:            %9"PRIu32"\n", intrf->stats.igmp_csumdropped);
 		fprintf(f," # V1 Reports Sent:          %9"PRIu32"\n", intrf->stats.igmp_txreportv1);
 		fprintf(f," # V2 Reports Sent:          %9"PRIu32"\n", intrf->stats.igmp_txreportv2);
+		fprintf(f," # V3 Reports Sent:          %9"PRIu32"\n", intrf->stats.igmp_txreportv3);
+		fprintf(f," Compatibility Mode:  IGMPv%i\n", igmp_compat_version(intrf));
 		fprintf(f," # Leave Group Msgs. Sent:   %9"PRIu32"\n", intrf->stats.igmp_txleave);
 	}
 	if ( (IPBSC_IFSTAT_INFO_MCGRP & info ) ) {
@@ -5352,16 +9002,18 @@ LanIpBscIfSumStats *ppsums = 0;
 
 	psums->ip_rx_drop    = pif->stats.ip_mcdstdropped + pif->stats.ip_frgdropped;
 	psums->ip_rx_drop   += pif->stats.ip_lendropped   + pif->stats.ip_protdropped;
-	psums->ip_rx_drop   += pif->stats.ip_dstdropped;
+	psums->ip_rx_drop   += pif->stats.ip_dstdropped   + pif->stats.ip_mcsrcdropped;
 
 	psums->icmp_rx_ereq  = pif->stats.icmp_rxechoreq;
 	psums->icmp_rx_drop  = pif->stats.icmp_hdrdropped + pif->stats.icmp_opdropped;
 
 	psums->igmp_rx_reps  = pif->stats.igmp_rxreportv1 + pif->stats.igmp_rxreportv2;
 	psums->igmp_rx_qrys  = pif->stats.igmp_rxqueryv1  + pif->stats.igmp_rxqueryv2;
+	psums->igmp_rx_qrys += pif->stats.igmp_rxqueryv3;
 	psums->igmp_rx_drop  = pif->stats.igmp_lendropped + pif->stats.igmp_csumdropped;
 	psums->igmp_rx_drop += pif->stats.igmp_hdrdropped;
 	psums->igmp_tx_reps  = pif->stats.igmp_txreportv1 + pif->stats.igmp_txreportv2;
+	psums->igmp_tx_reps += pif->stats.igmp_txreportv3;
 	psums->igmp_tx_leav  = pif->stats.igmp_txleave;
 
 
@@ -5370,6 +9022,11 @@ LanIpBscIfSumStats *ppsums = 0;
 	psums->udp_rx_drop  += pif->stats.udp_hdrdropped;
 	psums->udp_tx_frms   = pif->stats.udp_txfrm;
 
+	psums->arp_lk_fast   = pif->stats.arp_lkfast;
+	psums->arp_lk_lock   = pif->stats.arp_lklocked;
+	psums->arp_evicted   = pif->stats.arp_evicted;
+	psums->arp_nospc     = pif->stats.arp_nospc;
+
 	}
 
 	return rval;
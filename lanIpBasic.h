@@ -38,6 +38,8 @@
 #include <lanIpProto.h>
 #include <rtems.h>
 #include <stdio.h>
+#include <time.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -170,6 +172,18 @@ udpSockSend(int sd, void *payload, int payload_len);
 int
 udpSockSendTo(int sd, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport);
 
+/* Send data gathered from 'iovcnt' segments over a 'connected' socket.
+ *
+ * RETURNS: number of bytes sent or -errno.
+ *
+ * NOTES:   If the driver supports it then the segments
+ *          are handed to the device directly; otherwise
+ *          they are copied into a single buffer.
+ *          The segments need not be aligned.
+ */
+int
+udpSockSendV(int sd, const struct iovec *iov, int iovcnt);
+
 int
 _udpSockSendTo_internal(int sd, LanIpPacket buf_p, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport);
 
@@ -195,6 +209,155 @@ udpSockSendBuf(int sd, LanIpPacket b, int payload_len);
 int
 udpSockSendBufTo(int sd, LanIpPacket b, int payload_len, uint32_t ipaddr, uint16_t dport);
 
+/* Send the same payload to 'n' (unicast) destinations.
+ * The payload is stored in buffer 'b' (as for udpSockSendBuf())
+ * which is shared by all packets; only the headers are built
+ * separately for every destination (IP address in network-,
+ * port in host-byte order).
+ * The buffer is consumed (even if an error is returned).
+ *
+ * NOTES:   Drivers with a FIFO (lan9118) gather headers and
+ *          payload; drivers which can chain buffers (pcn32)
+ *          chain a header buffer to the shared payload. Other
+ *          drivers (and multicast loopback as well as packets
+ *          held back in a TX queue) use copies of the payload.
+ *
+ * RETURNS: number of destinations the packet was sent to or
+ *          -errno (-EBADF, -EINVAL, -EMSGSIZE, -EISCONN: socket
+ *          is connected to a different peer).
+ */
+typedef struct LanIpDestRec_ {
+	uint32_t ipaddr;
+	uint16_t dport;
+} LanIpDestRec;
+
+int
+udpSockSendMulti(int sd, LanIpPacket b, int payload_len, const LanIpDestRec *dests, int n);
+
+/* Send data directly out of a (large) application
+ * memory region.
+ *
+ * The region is registered once; subsequently, any
+ * slice of it may be sent as the payload of a UDP
+ * packet. The slice must not be modified until the
+ * stack calls the region's 'done' callback for it:
+ *
+ *   done(rgn, ptr, len, status, closure)
+ *
+ * 'status' is the number of bytes sent or -errno if
+ * the packet could not be sent. The callback is
+ * executed exactly once for every udpSockSendRegion()
+ * call which returns a positive value; if the call
+ * fails then the slice is not referenced and the
+ * callback is not executed.
+ *
+ * NOTES:   The payload is not copied if the driver
+ *          can send it by reference:
+ *            - FIFO drivers (lan9118) gather the
+ *              header and the slice while writing the
+ *              FIFO; the slice must be word-aligned.
+ *              The slice completes when the chip
+ *              reports TX status.
+ *            - Drivers with a two-descriptor path
+ *              (pcnet) send the slice behind a header
+ *              buffer; the slice completes when the
+ *              descriptors are reclaimed.
+ *          Other drivers, multicast loopback, packets
+ *          held back in a TX queue or waiting for an
+ *          ARP reply use a copy of the slice. Such a
+ *          slice completes when the driver reports the
+ *          copy as sent (or when it is handed to the
+ *          driver if the driver reports no TX status).
+ *
+ *          The callback is executed from a driver or
+ *          stack task (or from the sender); it must
+ *          not block and must not send from the same
+ *          socket.
+ *
+ *          A region with slices in flight on an
+ *          interface which is brought down may never
+ *          complete them (udpSockUnregisterRegion()
+ *          keeps failing).
+ *
+ *          'ipaddr' == 0 sends over a connected socket
+ *          (like udpSockSend()). Fragmentation is not
+ *          supported.
+ *
+ * RETURNS: Region handle (udpSockRegisterRegion()) or NULL
+ *          if no memory is available;
+ *          0 or -EBUSY if slices are still in use
+ *          (udpSockUnregisterRegion());
+ *          number of bytes sent or -errno
+ *          (udpSockSendRegion()); -EINVAL if the slice
+ *          is empty, not within the region or
+ *          misaligned.
+ */
+typedef struct LanIpRegionRec_ *LanIpRegion;
+
+typedef void (*LanIpRegionDoneProc)(LanIpRegion rgn, void *ptr, int len, int status, void *closure);
+
+LanIpRegion
+udpSockRegisterRegion(void *base, size_t size, LanIpRegionDoneProc done, void *closure);
+
+int
+udpSockUnregisterRegion(LanIpRegion rgn);
+
+int
+udpSockSendRegion(int sd, LanIpRegion rgn, void *ptr, int len, uint32_t ipaddr, uint16_t dport);
+
+
+/* Asynchronous TX status reporting.
+ *
+ * After creating a status queue (of 'depth' records)
+ * for a socket, packets may be sent 'tagged' with an
+ * arbitrary 'cookie'. Once the driver is done with a
+ * tagged packet a record holding the cookie, the
+ * outcome and the completion time is posted to the
+ * socket's status queue where it can be retrieved
+ * with udpSockGetTxStatus().
+ *
+ * Record 'status' is the payload length if the packet
+ * was sent or -errno:
+ *    -EIO:      TX error reported by the hardware
+ *               (late collision, loss of carrier, ...)
+ *    -ENETDOWN: link down; packet dropped by driver
+ *
+ * NOTES:   If the driver does not report TX status
+ *          (NETDRV_TX_STATUS) then the record is posted
+ *          when the packet is handed to the driver.
+ *
+ *          Records are lost if the status queue is
+ *          full (statistics counter).
+ *
+ *          udpSockSetTxStatusQueue() with 'depth' <= 0
+ *          deletes the queue (and any pending records).
+ *
+ *          'timeout_ticks' has the same semantics as
+ *          for udpSockRecv().
+ *
+ * RETURNS: 0 on success, -errno on error;
+ *          udpSockSendTagged(): number of bytes sent or
+ *          -errno; -EINVAL if the socket has no status
+ *          queue, -ENOBUFS if too many tagged packets
+ *          are in flight. No record is posted if the
+ *          packet could not be sent.
+ *          udpSockGetTxStatus(): -EAGAIN, -ETIMEDOUT
+ *          if no record was available.
+ */
+typedef struct UdpSockTxStatusRec_ {
+	uint32_t        cookie;   /* as passed to udpSockSendTagged()     */
+	int             status;   /* # bytes sent or -errno               */
+	struct timespec tstmp;    /* completion time (system uptime)      */
+} UdpSockTxStatusRec, *UdpSockTxStatus;
+
+int
+udpSockSetTxStatusQueue(int sd, int depth);
+
+int
+udpSockSendTagged(int sd, void *payload, int payload_len, uint32_t ipaddr, uint16_t dport, uint32_t cookie);
+
+int
+udpSockGetTxStatus(int sd, UdpSockTxStatus p_sts, int timeout_ticks);
 
 extern uint32_t udpSockMcastIfAddr;
 
@@ -219,6 +382,181 @@ udpSockSetIfMcast(int sd, uint32_t ifipaddr);
 int
 udpSockSetMcastLoopback(int sd, int val);
 
+/*
+ * Read and set the TX priority class of a socket.
+ * Class 0 has the highest priority. When the driver
+ * runs out of TX descriptors or FIFO space then
+ * packets are held back in per-class software
+ * queues which are drained strictly by priority,
+ * i.e., a packet is only passed to the driver if
+ * no packet of a higher class is waiting.
+ *
+ * RETURNS: Previous class (>=0) or a negative
+ *          error status.
+ *
+ * NOTES:   If 'prio' < 0 then the class is not
+ *          actually set. This can be used to read
+ *          the current setting.
+ *
+ *          Priority classes are only effective if
+ *          the driver supports them. Otherwise all
+ *          packets are sent in FIFO order.
+ *
+ *          Packets already handed to the driver are
+ *          not reordered. E.g., the gnreth driver only
+ *          holds packets back once its descriptor ring
+ *          and GNR_TXSUB_PRIO_DEPTH slots of its TX
+ *          submission ring are in use.
+ *
+ *          Per-class statistics are available from
+ *          lanIpBscDumpIfStats() (IPBSC_IFSTAT_INFO_UDP).
+ */
+int
+udpSockSetTxPriority(int sd, int prio);
+
+/*
+ * Define what a sender does if the socket's TX priority
+ * queue is full:
+ *   timeout_ticks == 0: fail fast; the packet is dropped
+ *                       and -ENOBUFS returned (default).
+ *   timeout_ticks  < 0: wait forever for room.
+ *   timeout_ticks  > 0: wait up to 'timeout_ticks' (in
+ *                       total) for room, then drop
+ *                       (-ENOBUFS).
+ *
+ * RETURNS: 0 on success or (negative) error status.
+ *
+ * NOTES:   Only effective if the driver supports
+ *          TX priority classes (otherwise the driver
+ *          handles a full TX ring/FIFO itself).
+ *
+ *          A blocking socket must not be used for
+ *          sending from the driver task (e.g., from
+ *          a RX callback) since that task must run
+ *          to make room.
+ */
+int
+udpSockSetTxTimeout(int sd, int timeout_ticks);
+
+/*
+ * Enable (enable > 0) or disable (enable == 0) IP
+ * fragmentation for a socket:
+ *   - datagrams bigger than what fits into a single
+ *     frame are sent as IP fragments (only by
+ *     udpSockSend() and udpSockSendTo()).
+ *   - reassembled datagrams are accepted; these are
+ *     delivered as a chain of buffers which must be
+ *     read with udpSockBufSegs().
+ *
+ * RETURNS: previous setting (0/1) or (negative) error status.
+ *
+ * NOTES:   If 'enable' < 0 then the setting is not
+ *          modified. This can be used to read the
+ *          current setting.
+ *
+ *          The max. datagram size and the number of
+ *          datagrams that can be reassembled concurrently
+ *          are compile-time parameters (IP_REASM_MAXFRAGS,
+ *          IP_REASM_NENTRIES). Incomplete datagrams are
+ *          discarded after IP_REASM_TIMEOUT_MS.
+ *
+ *          Fragmented datagrams are not looped back to
+ *          local multicast listeners.
+ */
+int
+udpSockSetFragmentation(int sd, int enable);
+
+/*
+ * Pace the traffic sent from a socket with a token bucket:
+ * the average rate is limited to 'rate' bytes/s and bursts
+ * to 'burst' bytes (UDP payload plus Ethernet/IP/UDP headers
+ * are accounted for). A sender exceeding the rate is delayed
+ * until enough tokens have accumulated.
+ * 'burst' is rounded up to the size of the largest
+ * unfragmented frame (max. UDP payload plus headers).
+ * A 'rate' of zero disables pacing.
+ *
+ * RETURNS: 0 on success or (negative) error status;
+ *          -ENOTSUP if no usable hardware timer is available.
+ *
+ * NOTES:   The delay is implemented by sleeping, i.e., it
+ *          has the granularity of the system clock tick; the
+ *          average rate is still maintained.
+ *
+ *          A fragmented datagram is accounted for as a
+ *          whole and may exceed 'burst'; its sender is
+ *          delayed until the deficit is paid off.
+ *
+ *          The hardware timer is calibrated on first use
+ *          which takes about 100ms.
+ *
+ *          Statistics (number of delayed sends, max. and
+ *          average delay) are reset by this call and are
+ *          available from lanIpBscDumpIfStats()
+ *          (IPBSC_IFSTAT_INFO_UDP).
+ */
+int
+udpSockSetPacing(int sd, uint32_t rate, uint32_t burst);
+
+/*
+ * Record the TX latencies of a socket in (log2) histograms:
+ * the time from entering a send routine until the packet
+ * was handed to the driver (or queued for transmission)
+ * and until the driver reported completion.
+ * udpSockSetTxLatency() enables (clearing the histograms)
+ * or disables recording; udpSockResetTxLatency() clears
+ * and udpSockDumpTxLatency() prints the histograms
+ * (f == NULL prints to stdout).
+ *
+ * RETURNS: 0 on success or (negative) error status;
+ *          -ENOTSUP if no usable hardware timer is available.
+ *
+ * NOTES:   Time spent in pacing (udpSockSetPacing()) is not
+ *          included.
+ *
+ *          Completion is only recorded if a TX status tag
+ *          is available (a separate pool of TXSTS_NLATTAGS
+ *          unless the packet is tagged anyways, e.g., by
+ *          udpSockSendTagged()) and for unfragmented
+ *          datagrams. W/o driver support for TX status
+ *          completion is the same as handing to the driver.
+ *
+ *          The hardware timer is calibrated on first use
+ *          which takes about 100ms.
+ */
+int
+udpSockSetTxLatency(int sd, int enable);
+
+int
+udpSockResetTxLatency(int sd);
+
+int
+udpSockDumpTxLatency(int sd, FILE *f);
+
+/*
+ * Make sends from a socket never wait for ARP
+ * replies ('enable' nonzero) or restore the default
+ * (block until the destination is resolved).
+ *
+ * RETURNS: 0 on success or (negative) error status.
+ *
+ * NOTES:   If the destination is not in the ARP cache
+ *          then the datagram is held back, a request
+ *          is sent and the send routine returns
+ *          immediately (reporting success). Held
+ *          datagrams are sent when the reply arrives
+ *          or dropped (and counted in the ARP statistics;
+ *          tagged datagrams report -EHOSTUNREACH) if
+ *          there is no reply after several retries.
+ *
+ *          Only a few datagrams per destination are
+ *          held; further sends fail with -ENOBUFS.
+ *          Datagrams that must be fragmented are never
+ *          held (-ENOTCONN).
+ */
+int
+udpSockSetArpNoWait(int sd, int enable);
+
 /*
  * Join and leave a multicast group.
  */
@@ -228,6 +566,38 @@ udpSockJoinMcast(int sd, uint32_t mcaddr);
 int
 udpSockLeaveMcast(int sd, uint32_t mcaddr);
 
+/*
+ * Join a multicast group receiving only from selected
+ * sources (source-specific multicast, IGMPv3):
+ *
+ *   LANIP_MCAST_INCLUDE: only datagrams from the 'nsrcs'
+ *                        sources in 'srcs' are accepted
+ *                        ('nsrcs' must be nonzero).
+ *   LANIP_MCAST_EXCLUDE: datagrams from all sources but
+ *                        the ones in 'srcs' are accepted
+ *                        ('nsrcs' == 0 is equivalent to
+ *                        udpSockJoinMcast()).
+ *
+ * Source addresses are in network byte order. If 'sd'
+ * already is a member of the group then its filter is
+ * replaced. The filters of all sockets are merged and
+ * reported so that the network only forwards traffic
+ * we want; datagrams from other sources are dropped
+ * early (IP layer).
+ *
+ * RETURNS: 0 on success or (negative) error status.
+ *
+ * NOTES:   At most MC_SRCFILT_MAX (compile-time; 64)
+ *          sources per socket and group.
+ *          While an IGMPv1/v2 querier is present the
+ *          filters are only enforced locally.
+ */
+#define LANIP_MCAST_EXCLUDE	0
+#define LANIP_MCAST_INCLUDE	1
+
+int
+udpSockJoinMcastSrc(int sd, uint32_t mcaddr, int mode, const uint32_t *srcs, unsigned nsrcs);
+
 /* Create private data (pass as rx callback closure pointer to drvLan9118Start)
  * 
  * This can be thought of as (and should better be called) an 'interface handle'.
@@ -255,6 +625,19 @@ udpSockGetIf(int sd);
 IpBscIf
 udpSockGetBufIf(LanIpPacket buf_p);
 
+/* Obtain the payload segments of a received UDP packet.
+ * A datagram which was reassembled from IP fragments
+ * consists of multiple segments (one per fragment);
+ * any other packet has a single segment.
+ * Up to 'iovcnt' segments are stored in 'iov'.
+ *
+ * RETURNS: total number of segments (may be more than 'iovcnt').
+ *
+ * NOTES:   udpSockFreeBuf() releases all segments.
+ */
+int
+udpSockBufSegs(LanIpPacket buf_p, struct iovec *iov, int iovcnt);
+
 /* Tear down interface handle and release all resources associated
  * with it (but *not* the driver). The interface and driver handles
  * are separate objects ('drv_p' passed to lanIpBscIfCreate() is only
@@ -294,6 +677,14 @@ udpSockHdrsInitFromIf(IpBscIf intrf, LanUdpPkt p, uint32_t dipaddr, uint16_t dpo
 void
 udpSockHdrsSetlen(LanUdpPkt p, int payload_len);
 
+/* Set destination IP address (network byte order), length and IP checksum.
+ * The checksum is updated incrementally from the other header fields, i.e.,
+ * the same way the socket send routines do it. The result is identical to
+ * setting 'ip.dst' and calling udpSockHdrsSetlen().
+ */
+void
+udpSockHdrsSetlenDst(LanUdpPkt p, int payload_len, uint32_t dipaddr);
+
 /* Flip source -> dest and fill-in local source addresses
  * (at ethernet, IP and UDP level) and IP checksum.
  */
@@ -337,6 +728,12 @@ lanIpBscSendBufRawIp(IpBscIf intrf, LanIpPacket buf_p);
 
 extern int lanIpBscAutoRefreshARP;
 
+/* RX refreshes are skipped if the sender's entry holds
+ * the same MAC address and was stored less than this
+ * many ticks ago (0 refreshes on every packet).
+ */
+extern rtems_interval lanIpBscAutoRefreshARPTicks;
+
 /* 'Manual' maintenance of the ARP cache */
 
 /* Perform an ARP lookup for 'ipaddr' (network byte order) first
@@ -398,6 +795,99 @@ arpDelEntry(IpBscIf pd, uint32_t ipaddr);
 void
 arpScavenger(IpBscIf pd, rtems_interval maxage, rtems_interval period, int nloops);
 
+/*
+ * Built-in aging of the IF's ARP cache (no extra task
+ * needed): non-permanent entries which have not been
+ * confirmed (ARP reply or -- if lanIpBscAutoRefreshARP
+ * is set -- received traffic) for 'maxage' seconds are
+ * evicted. Entries that are less than 'probe' seconds
+ * away from expiry and were used within the last 'probe'
+ * seconds are refreshed by sending a unicast ARP request
+ * to the known MAC address so that active peers never
+ * drop out of the cache.
+ *
+ * 'maxage' == 0 disables aging; 'probe' == 0 disables
+ * probing.
+ *
+ * RETURNS: 0 on success, -EINVAL if 'probe' >= 'maxage'.
+ *
+ * NOTES:   The defaults are ARP_AGE_MAXAGE/ARP_AGE_PROBE
+ *          (compile-time; aging is off unless defined).
+ *          Aging relies on the RTEMS time-of-day being set.
+ */
+int
+arpSetAging(IpBscIf pd, uint32_t maxage, uint32_t probe);
+
+/*
+ * Announce our IP/MAC address pair by sending 'count'
+ * gratuitous ARPs (broadcast requests for our own address)
+ * 'ival_ms' apart; the first one is sent immediately.
+ * Peers update stale entries (e.g., after the IP moved
+ * to replacement hardware) and need not ARP us before
+ * sending the first datagram.
+ * A sequence still in progress is replaced; 'count' == 0
+ * cancels it.
+ *
+ * RETURNS: 0.
+ *
+ * NOTES:   lanIpBscIfCreate() calls this with the
+ *          'arp_garp_count'/'arp_garp_ival' settings
+ *          (see lanIpBscConfig(); default: no announcements).
+ */
+int
+arpAnnounce(IpBscIf pd, unsigned count, unsigned ival_ms);
+
+/*
+ * Bulk load and snapshot of the ARP cache (e.g., to
+ * restore a warm cache after reboot).
+ */
+typedef struct LanIpArpEntryRec_ {
+	uint32_t ipaddr;      /* IPv4 address (network byte order) */
+	uint8_t  hwaddr[6];   /* MAC address                       */
+	uint8_t  perm;        /* nonzero: permanent (static) entry */
+} LanIpArpEntryRec, *LanIpArpEntry;
+
+/*
+ * Store 'n' entries holding the ARP lock only once.
+ * Entries loaded as non-permanent are revalidated
+ * in the background (paced ARP requests; a reply
+ * refreshes or corrects the entry).
+ *
+ * RETURNS: # entries stored or (negative) error status
+ *          if none could be stored (-EINVAL for addresses
+ *          that are not on the IF's subnet).
+ */
+int
+arpLoad(IpBscIf pd, const LanIpArpEntryRec *ents, int n);
+
+/*
+ * Copy up to 'max' resolved entries of the ARP cache
+ * to 'ents' (the 'compact binary form').
+ *
+ * RETURNS: # entries copied.
+ */
+int
+arpSnapshot(IpBscIf pd, LanIpArpEntryRec *ents, int max);
+
+/*
+ * Load entries from/save the cache to a text file with
+ * one entry per line:
+ *
+ *   <ip> <mac> [<perm>]
+ *
+ * e.g., '10.0.0.1 00:0a:35:00:01:22 1'. Empty lines and
+ * lines starting with '#' are ignored; <perm> defaults
+ * to 0. arpSaveFile() writes the same format.
+ *
+ * RETURNS: # entries loaded/saved or (negative) error
+ *          status.
+ */
+int
+arpLoadFile(IpBscIf pd, const char *fnam);
+
+int
+arpSaveFile(IpBscIf pd, const char *fnam);
+
 /* Flush the entire arp cache (except for permanent/static entires
  * if 'perm_also' is zero).
  */
@@ -481,6 +971,9 @@ lanIpBscDrvCreate(int instance, uint8_t *enaddr_p);
 #define LANIPCFG_TX_RING	(1<<1)
 #define LANIPCFG_N_RBUFS	(1<<2)
 #define LANIPCFG_SQDEPTH	(1<<3)
+#define LANIPCFG_ARPCSZ 	(1<<4)
+#define LANIPCFG_ARPNSEM	(1<<5)
+#define LANIPCFG_GARP   	(1<<6)
 
 typedef struct LanIpBscConfigRec_ {
 	unsigned mask;
@@ -488,6 +981,16 @@ typedef struct LanIpBscConfigRec_ {
 	unsigned tx_ring_size;
 	unsigned num_rbufs;
 	unsigned rx_queue_depth;
+	unsigned arp_cache_size;  /* # ARP cache slots (rounded up to power of 2;
+	                           * takes effect when the next IF is created)
+	                           */
+	unsigned arp_nsems;       /* # preallocated semaphores for ARP lookups
+	                           * (more are created if needed)
+	                           */
+	unsigned arp_garp_count;  /* # gratuitous ARPs sent when an IF is created
+	                           * (0: none; LANIPCFG_GARP also sets 'ival')
+	                           */
+	unsigned arp_garp_ival;   /* ms between gratuitous ARPs                 */
 } LanIpBscConfigRec, *LanIpBscConfig;
 
 int
@@ -644,6 +1147,11 @@ typedef struct LanIpBscIfSumStatsRec_ {
 	uint32_t udp_rx_frms;  /* UDP frames receifed                                 */
 	uint32_t udp_rx_drop;  /* Frames dropped by UDP layer                         */
 	uint32_t udp_tx_frms;  /* UDP frames sent (from sockets)                      */
+
+	uint32_t arp_lk_fast;  /* ARP cache hits served w/o taking the lock           */
+	uint32_t arp_lk_lock;  /* ARP lookups that had to take the lock               */
+	uint32_t arp_evicted;  /* ARP entries evicted (LRU) to make room              */
+	uint32_t arp_nospc;    /* ARP entries not stored (no evictable slot)          */
 } LanIpBscIfSumStatsRec, *LanIpBscIfSumStats;
 
 typedef struct LanIpBscSumStatsRec_ {
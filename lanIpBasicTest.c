@@ -11,8 +11,13 @@
 /* Note: the name of this file is historic and unfortunate... */
 
 #include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
 
+#include <netinet/in_systm.h>
 #include <netinet/in.h>
+#include <netinet/ip.h>
+#include <machine/in_cksum.h>
 
 #define PAYLDLEN 1024
 
@@ -290,6 +295,803 @@ egress:
 	return(err);
 }
 
+/* Check that a connected socket picks up a changed ARP entry when sending
+ * from user buffers (udpSockSendBuf()). The peer must echo our datagrams,
+ * e.g., run 'udpBouncer(0, 0, <our ip>, <port>)'.
+ *
+ * The peer's entry is first replaced by a bogus MAC and then restored;
+ * both datagrams sent afterwards must be echoed.
+ *
+ * RETURNS: 0 on success, nonzero on failure.
+ */
+int
+lanIpTstArpChange(uint32_t dipaddr, uint16_t dport)
+{
+static uint8_t bogus[6] = { 0x02, 0x00, 0xde, 0xad, 0xbe, 0xef };
+uint8_t     mac[6];
+LanIpPacket p;
+int         i, st, got = 0;
+int         tout = ms2ticks( lanIpUdpMstTo );
+
+	if ( (st = arpLookup(lanIpIf, dipaddr, mac, 0)) ) {
+		fprintf(stderr,"lanIpTstArpChange: peer not reachable: %s\n", strerror(-st));
+		return st;
+	}
+
+	if ( (st = udpSockConnect(lanIpUdpsd, dipaddr, dport, 0)) ) {
+		fprintf(stderr,"lanIpTstArpChange: unable to connect socket: %s\n", strerror(-st));
+		return st;
+	}
+
+	/* socket resolves the bogus MAC ... */
+	arpPutEntry(lanIpIf, dipaddr, bogus, 0);
+	if ( (p = udpSockGetBuf()) ) {
+		memset( &lpkt_udp_pld(p,echodata), 0, sizeof(echodata) );
+		udpSockSendBuf(lanIpUdpsd, p, PAYLDLEN);
+	}
+
+	/* ... and must pick up the real one again */
+	arpPutEntry(lanIpIf, dipaddr, mac, 0);
+
+	/* flush whatever is queued */
+	while ( (p = udpSockRecv(lanIpUdpsd, 0)) )
+		udpSockFreeBuf(p);
+
+	for ( i=0; i<2; i++ ) {
+		if ( ! (p = udpSockGetBuf()) ) {
+			fprintf(stderr,"lanIpTstArpChange: unable to allocate buffer\n");
+			goto egress;
+		}
+		memset( &lpkt_udp_pld(p,echodata), 0, sizeof(echodata) );
+		/* buffer is consumed (even on error) */
+		if ( (st = udpSockSendBuf(lanIpUdpsd, p, PAYLDLEN)) < 0 ) {
+			fprintf(stderr,"lanIpTstArpChange: send #%i failed: %s\n", i, strerror(-st));
+			goto egress;
+		}
+		if ( (p = udpSockRecv(lanIpUdpsd, tout)) ) {
+			udpSockFreeBuf(p);
+			got++;
+		}
+	}
+
+egress:
+	udpSockConnect(lanIpUdpsd, 0, 0, 0);
+
+	fprintf(stderr,"lanIpTstArpChange: %s (%i/2 echoed)\n", 2 == got ? "PASSED" : "FAILED", got);
+
+	return 2 == got ? 0 : -1;
+}
+
+/* Check the incremental IP header checksum used by the socket send routines
+ * (udpSockHdrsSetlenDst()) against a full in_cksum_hdr() over the same header
+ * for many lengths, IP ids and destinations. Pure software; no interface or
+ * peer is needed.
+ *
+ * For every length, some destinations are chosen so that the header sum ends
+ * up right at 0xffff (checksum 0x0000) or just wraps around to 0x0000 (end-
+ * around carry).
+ *
+ * RETURNS: 0 on success, -1 on failure.
+ */
+int
+lanIpTstCsum(void)
+{
+static const uint16_t ids[] = { 0x0000, 0x0001, 0x00ff, 0x1234, 0x7fff, 0x8000, 0xfffe, 0xffff };
+LanUdpPktRec hdr;
+IpHeaderRec  ip;
+uint32_t     dst[20];
+uint16_t     sum, want;
+int          i, j, k, nd, len;
+unsigned     n = 0, bad = 0, zero = 0;
+
+	for ( i=0; i<sizeof(ids)/sizeof(ids[0]); i++ ) {
+		memset( &hdr, 0, sizeof(hdr) );
+		hdr.ip_part.ip.vhl  = 0x45;
+		hdr.ip_part.ip.id   = htons( ids[i] );
+		hdr.ip_part.ip.ttl  = 255 - i;
+		hdr.ip_part.ip.prot = 17; /* UDP */
+		hdr.ip_part.ip.src  = htonl( 0x0a000001 + (rand() & 0xffff) );
+
+		for ( len = 0; len <= 1500 - sizeof(UdpHeaderRec) - sizeof(IpHeaderRec); len++ ) {
+
+			/* header sum w/o destination */
+			udpSockHdrsSetlenDst( &hdr, len, 0 );
+			sum = ~hdr.ip_part.ip.csum;
+
+			nd  = 0;
+			dst[nd++] = 0;
+			dst[nd++] = 0xffffffff;
+			for ( k = -2; k <= 2; k++ ) {
+				/* make the sum hit 0xffff + k */
+				dst[nd++] = (uint16_t)(0xffff - sum + k);
+				dst[nd++] = (uint32_t)(uint16_t)(0xffff - sum + k) << 16;
+			}
+			while ( nd < sizeof(dst)/sizeof(dst[0]) )
+				dst[nd++] = ((uint32_t)rand() << 16) ^ rand();
+
+			for ( j = 0; j < nd; j++ ) {
+				udpSockHdrsSetlenDst( &hdr, len, dst[j] );
+
+				ip      = hdr.ip_part.ip;
+				ip.csum = 0;
+				want    = in_cksum_hdr( (void*)&ip );
+
+				if (   hdr.ip_part.ip.csum != want
+				    || hdr.ip_part.ip.dst  != dst[j]
+				    || ntohs( hdr.ip_part.ip.len ) != len + sizeof(UdpHeaderRec) + sizeof(IpHeaderRec)
+				    || ntohs( hdr.udp.len )        != len + sizeof(UdpHeaderRec) ) {
+					if ( bad++ < 10 ) {
+						fprintf(stderr,"lanIpTstCsum: mismatch (id 0x%04x, len %i, dst 0x%08"PRIx32"): got 0x%04x, expected 0x%04x\n",
+							ids[i], len, dst[j], hdr.ip_part.ip.csum, want);
+					}
+				}
+				if ( 0 == want )
+					zero++;
+				n++;
+			}
+		}
+	}
+
+	/* the edge cases must actually have been hit */
+	fprintf(stderr,"lanIpTstCsum: %s (%u headers, %u mismatches, %u with zero checksum)\n",
+		bad || !zero ? "FAILED" : "PASSED", n, bad, zero);
+
+	return bad || !zero ? -1 : 0;
+}
+
+/* Obtain the IF's summary statistics (NULL if the interface is not set up).
+ * Release with lanIpBscFreeStats().
+ */
+static LanIpBscSumStats
+tstIfStats(void)
+{
+LanIpBscSumStats st;
+
+	if ( ! lanIpIf ) {
+		fprintf(stderr,"Interface not set up; use 'lanIpSetup()'\n");
+		return 0;
+	}
+	if ( ! (st = lanIpBscGetStats()) || ! st->if_stats ) {
+		fprintf(stderr,"Unable to obtain statistics\n");
+		lanIpBscFreeStats(st);
+		return 0;
+	}
+	return st;
+}
+
+/* Fill 'peers' with 'n' addresses on the IF's subnet, starting at host
+ * number 'first' and skipping our own address.
+ *
+ * RETURNS: 0 on success, -1 if the subnet is too small.
+ */
+static int
+tstPeers(LanIpBscIfSumStats ifs, uint32_t *peers, int n, uint32_t first)
+{
+uint32_t net  = ntohl( ifs->ip_addr & ifs->ip_nmask );
+uint32_t me   = ntohl( ifs->ip_addr );
+uint32_t bcst = net | ~ntohl( ifs->ip_nmask );
+uint32_t h;
+int      i;
+
+	for ( i=0, h = net + first; i<n; h++ ) {
+		if ( h >= bcst ) {
+			fprintf(stderr,"Subnet too small for %i peers\n", n);
+			return -1;
+		}
+		if ( h != me )
+			peers[i++] = htonl( h );
+	}
+	return 0;
+}
+
+/* Create and start a (time-sliced) benchmark task named 't<c><idx>' */
+static rtems_status_code
+tstTaskStart(char c, int idx, rtems_task_priority pri, rtems_task_entry entry, void *arg)
+{
+rtems_id          tid;
+rtems_status_code sc;
+
+	sc = rtems_task_create(
+				rtems_build_name('t', c, '0' + idx / 10 % 10, '0' + idx % 10),
+				pri,
+				10000,
+				RTEMS_DEFAULT_MODES | RTEMS_TIMESLICE,
+				RTEMS_FLOATING_POINT | RTEMS_LOCAL,
+				&tid);
+
+	if ( RTEMS_SUCCESSFUL == sc && RTEMS_SUCCESSFUL != (sc = rtems_task_start(tid, entry, (rtems_task_argument)arg)) )
+		rtems_task_delete(tid);
+
+	return sc;
+}
+
+/* ARP lookup contention benchmark.
+ *
+ * 'ntasks' tasks loop over arpLookup(..., cacheonly = 1) for a set of
+ * (permanent) peers while another task keeps replacing and scavenging
+ * non-permanent entries that share the cache with them. All tasks run
+ * at the caller's priority with time-slicing for 'secs' seconds.
+ *
+ * Prints the ratio of lookups served w/o taking the ARP lock vs. those
+ * that fell back to the locked path and the average time per lookup
+ * (hwtimer ticks).
+ *
+ * NOTE: Host numbers 1..32 of the IF's subnet are used as peers; their
+ *       cache entries are removed afterwards.
+ *
+ * RETURNS: 0 on success, -1 on error.
+ */
+#define BM_ARP_NPEERS   16
+#define BM_ARP_MAXTASKS 16
+
+typedef struct BmArpArgRec_ {
+	uint32_t          *peers;
+	int                npeers;
+	volatile uint32_t  nops;    /* lookups/updates done        */
+	volatile uint32_t  nfail;   /* lookups failed              */
+	volatile uint32_t  ticks;   /* hwtimer ticks spent looking */
+	rtems_id           done;    /* released when task exits    */
+} BmArpArgRec, *BmArpArg;
+
+static volatile int bmArpRun;
+
+static rtems_task
+bmArpLookupTask(rtems_task_argument arg)
+{
+BmArpArg a = (BmArpArg)arg;
+uint8_t  mac[6];
+uint32_t then;
+int      i = 0;
+
+	while ( bmArpRun ) {
+		then = Read_hwtimer();
+		if ( arpLookup(lanIpIf, a->peers[i], mac, 1) )
+			a->nfail++;
+		a->ticks += Read_hwtimer() - then;
+		a->nops++;
+		if ( ++i >= a->npeers )
+			i = 0;
+	}
+	rtems_semaphore_release(a->done);
+	rtems_task_delete(RTEMS_SELF);
+}
+
+static rtems_task
+bmArpChurnTask(rtems_task_argument arg)
+{
+BmArpArg a = (BmArpArg)arg;
+uint8_t  mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
+int      i = 0;
+
+	while ( bmArpRun ) {
+		mac[5]++;
+		arpPutEntry(lanIpIf, a->peers[i], mac, 0);
+		a->nops++;
+		if ( ++i >= a->npeers ) {
+			i = 0;
+			/* evicts everything not refreshed this second */
+			arpScavenger(lanIpIf, 0, 0, 1);
+		}
+	}
+	rtems_semaphore_release(a->done);
+	rtems_task_delete(RTEMS_SELF);
+}
+
+int
+lanIpBmArpLookup(int ntasks, int secs)
+{
+static uint8_t      mac[6] = { 0x02, 0x00, 0xbe, 0x9c, 0x00, 0x00 };
+uint32_t            peers[2*BM_ARP_NPEERS];
+BmArpArgRec         args[BM_ARP_MAXTASKS + 1];
+LanIpBscSumStats    st0 = 0, st1 = 0;
+rtems_id            done = 0;
+rtems_task_priority pri;
+rtems_interval      rate;
+rtems_status_code   sc;
+uint32_t            nlook = 0, nfail = 0, ticks = 0, fast, lock;
+int                 i, npeers = 0, started = 0, rval = -1;
+
+	if ( ntasks < 1 || ntasks > BM_ARP_MAXTASKS || secs < 1 ) {
+		fprintf(stderr,"Usage: lanIpBmArpLookup(int ntasks [1..%i], int secs)\n", BM_ARP_MAXTASKS);
+		return -1;
+	}
+
+	if ( ! (st0 = tstIfStats()) )
+		return -1;
+
+	if ( tstPeers(st0->if_stats, peers, 2*BM_ARP_NPEERS, 1) )
+		goto egress;
+	npeers = 2*BM_ARP_NPEERS;
+
+	for ( i=0; i<BM_ARP_NPEERS; i++ ) {
+		mac[5] = i;
+		if ( arpPutEntry(lanIpIf, peers[i], mac, 1) ) {
+			fprintf(stderr,"lanIpBmArpLookup: unable to store peer #%i\n", i);
+			goto egress;
+		}
+	}
+
+	sc = rtems_semaphore_create(
+			rtems_build_name('t','a','d','n'),
+			0,
+			RTEMS_COUNTING_SEMAPHORE | RTEMS_FIFO,
+			0,
+			&done);
+	if ( RTEMS_SUCCESSFUL != sc ) {
+		rtems_error(sc, "lanIpBmArpLookup: unable to create semaphore");
+		goto egress;
+	}
+
+	rtems_task_set_priority(RTEMS_SELF, RTEMS_CURRENT_PRIORITY, &pri);
+
+	lanIpBscFreeStats(st0);
+	st0 = lanIpBscGetStats();
+
+	bmArpRun = 1;
+
+	/* args[0] is the churn task; it works on the second half of 'peers' */
+	for ( i=0; i<=ntasks; i++ ) {
+		memset( &args[i], 0, sizeof(args[i]) );
+		args[i].peers  = i ? peers : peers + BM_ARP_NPEERS;
+		args[i].npeers = BM_ARP_NPEERS;
+		args[i].done   = done;
+
+		sc = tstTaskStart('a', i, pri, i ? bmArpLookupTask : bmArpChurnTask, &args[i]);
+		if ( RTEMS_SUCCESSFUL != sc ) {
+			rtems_error(sc, "lanIpBmArpLookup: unable to create/start task #%i", i);
+			break;
+		}
+		started++;
+	}
+
+	if ( started > ntasks ) {
+		rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &rate);
+		rtems_task_wake_after( secs * rate );
+	}
+
+	bmArpRun = 0;
+
+	for ( i=0; i<started; i++ )
+		rtems_semaphore_obtain(done, RTEMS_WAIT, RTEMS_NO_TIMEOUT);
+
+	if ( started <= ntasks || ! st0 || ! (st1 = lanIpBscGetStats()) )
+		goto egress;
+
+	for ( i=1; i<=ntasks; i++ ) {
+		nlook += args[i].nops;
+		nfail += args[i].nfail;
+		ticks += args[i].ticks;
+	}
+
+	fast = st1->if_stats->arp_lk_fast - st0->if_stats->arp_lk_fast;
+	lock = st1->if_stats->arp_lk_lock - st0->if_stats->arp_lk_lock;
+
+	fprintf(stderr,"lanIpBmArpLookup: %i tasks, %is, %"PRIu32" updates by churn task\n", ntasks, secs, args[0].nops);
+	fprintf(stderr,"  lookups:  %10"PRIu32" (%"PRIu32" failed)\n", nlook, nfail);
+	fprintf(stderr,"  lock-free:%10"PRIu32", locked %"PRIu32" (%.2f%% fallback)\n",
+		fast, lock, fast + lock ? 100.0*(double)lock/(double)(fast + lock) : 0.0);
+	fprintf(stderr,"  avg. time per lookup: %.2f hwtimer ticks\n",
+		nlook ? (double)ticks/(double)nlook : 0.0);
+
+	rval = 0;
+
+egress:
+	if ( done )
+		rtems_semaphore_delete(done);
+	lanIpBscFreeStats(st0);
+	lanIpBscFreeStats(st1);
+	for ( i=0; i<npeers; i++ )
+		arpDelEntry(lanIpIf, peers[i]);
+	return rval;
+}
+
+/* Check that arpLoad() restores what arpSnapshot() saved: a few peers
+ * (permanent and not) are stored, the cache is snapshot, flushed
+ * (non-permanent entries only) and loaded from the snapshot. A second
+ * snapshot must then hold the same entries.
+ *
+ * NOTE: Host numbers 64..71 of the IF's subnet are used as peers; their
+ *       cache entries are removed afterwards.
+ *
+ * RETURNS: 0 on success, -1 on failure.
+ */
+#define TST_ARPSNAP_NPEERS 8
+
+static int
+tstArpFind(LanIpArpEntryRec *ents, int n, LanIpArpEntryRec *e)
+{
+int i;
+	for ( i=0; i<n; i++ ) {
+		if (    ents[i].ipaddr == e->ipaddr
+		     && ents[i].perm   == e->perm
+		     && 0 == memcmp( ents[i].hwaddr, e->hwaddr, 6 ) )
+			return i;
+	}
+	return -1;
+}
+
+int
+lanIpTstArpSnapshot(void)
+{
+static uint8_t    mac[6] = { 0x02, 0x00, 0x5a, 0x9e, 0x00, 0x00 };
+uint32_t          peers[TST_ARPSNAP_NPEERS];
+LanIpBscConfigRec cfg;
+LanIpBscSumStats  st;
+LanIpArpEntryRec  *a = 0, *b = 0, e;
+int               i, max, na, nb, nl, nperm = 0, bad = 0, npeers = 0;
+
+	if ( ! (st = tstIfStats()) )
+		return -1;
+
+	if ( tstPeers(st->if_stats, peers, TST_ARPSNAP_NPEERS, 64) ) {
+		bad++;
+		goto egress;
+	}
+	npeers = TST_ARPSNAP_NPEERS;
+
+	lanIpBscConfig(0, &cfg);
+	/* cache size is rounded up to a power of two */
+	max = 2*cfg.arp_cache_size + TST_ARPSNAP_NPEERS;
+
+	if ( ! (a = malloc( max * sizeof(*a) )) || ! (b = malloc( max * sizeof(*b) )) ) {
+		fprintf(stderr,"lanIpTstArpSnapshot: no memory\n");
+		bad++;
+		goto egress;
+	}
+
+	for ( i=0; i<npeers; i++ ) {
+		mac[5] = i;
+		if ( arpPutEntry(lanIpIf, peers[i], mac, i & 1) ) {
+			fprintf(stderr,"lanIpTstArpSnapshot: unable to store peer #%i\n", i);
+			bad++;
+			goto egress;
+		}
+	}
+
+	na = arpSnapshot(lanIpIf, a, max);
+
+	/* our peers must be in the snapshot */
+	for ( i=0; i<npeers; i++ ) {
+		e.ipaddr = peers[i];
+		memcpy( e.hwaddr, mac, 5 );
+		e.hwaddr[5] = i;
+		e.perm   = i & 1;
+		if ( tstArpFind(a, na, &e) < 0 ) {
+			fprintf(stderr,"lanIpTstArpSnapshot: peer #%i missing from snapshot\n", i);
+			bad++;
+		}
+	}
+
+	for ( i=0; i<na; i++ ) {
+		if ( a[i].perm )
+			nperm++;
+	}
+
+	arpFlushCache(lanIpIf, 0);
+
+	if ( (nb = arpSnapshot(lanIpIf, b, max)) != nperm ) {
+		fprintf(stderr,"lanIpTstArpSnapshot: %i entries left after flush (expected %i permanent ones)\n", nb, nperm);
+		bad++;
+	}
+
+	if ( (nl = arpLoad(lanIpIf, a, na)) != na ) {
+		fprintf(stderr,"lanIpTstArpSnapshot: arpLoad() returned %i (expected %i)\n", nl, na);
+		bad++;
+	}
+
+	nb = arpSnapshot(lanIpIf, b, max);
+
+	if ( nb != na ) {
+		fprintf(stderr,"lanIpTstArpSnapshot: %i entries after reload (expected %i)\n", nb, na);
+		bad++;
+	}
+	for ( i=0; i<na; i++ ) {
+		if ( tstArpFind(b, nb, &a[i]) < 0 ) {
+			fprintf(stderr,"lanIpTstArpSnapshot: entry #%i not restored\n", i);
+			bad++;
+		}
+	}
+
+egress:
+	for ( i=0; i<npeers; i++ )
+		arpDelEntry(lanIpIf, peers[i]);
+	free(a);
+	free(b);
+	lanIpBscFreeStats(st);
+
+	fprintf(stderr,"lanIpTstArpSnapshot: %s\n", bad ? "FAILED" : "PASSED");
+
+	return bad ? -1 : 0;
+}
+
+/* ARP cache sizing benchmark.
+ *
+ * Brings the stack up (like lanIpSetup() but w/o a socket) with the default
+ * ARP cache size and again with 'bigsz' slots (4 * BM_ARPC_NPEERS if zero).
+ * Each time, up to BM_ARPC_NPEERS addresses of the /20 containing 'ip' are
+ * stored with arpPutEntry() in random order and then looked up (cache
+ * only). Prints the # of evicted entries, of entries that could not be
+ * stored and the lookup miss rate.
+ *
+ * NOTE: The stack must be down (lanIpTakedown()) and 'nmsk' must cover
+ *       the /20; the previous configuration is restored afterwards.
+ *
+ * RETURNS: 0 on success, -1 on error.
+ */
+#define BM_ARPC_NPEERS 4096
+
+static int
+bmArpCacheRun(unsigned sz)
+{
+static uint8_t     mac[6] = { 0x02, 0x00, 0xbe, 0x9c, 0x00, 0x00 };
+uint32_t           *peers = 0;
+LanIpBscSumStats   st0 = 0, st1 = 0;
+LanIpBscIfSumStats ifs;
+uint32_t           blk, net, bcst, me, h, tmp;
+int                i, j, n = 0, putfail = 0, miss = 0, rval = -1;
+
+	if ( ! (st0 = tstIfStats()) )
+		return -1;
+
+	ifs  = st0->if_stats;
+	me   = ntohl( ifs->ip_addr );
+	net  = ntohl( ifs->ip_addr & ifs->ip_nmask );
+	bcst = net | ~ntohl( ifs->ip_nmask );
+	blk  = me & ~(uint32_t)(BM_ARPC_NPEERS - 1);
+
+	if ( ntohl( ifs->ip_nmask ) & (BM_ARPC_NPEERS - 1) ) {
+		fprintf(stderr,"lanIpBmArpCache: netmask must be /20 or shorter\n");
+		goto egress;
+	}
+
+	if ( ! (peers = malloc( BM_ARPC_NPEERS * sizeof(*peers) )) ) {
+		fprintf(stderr,"lanIpBmArpCache: no memory\n");
+		goto egress;
+	}
+
+	for ( h = blk; h < blk + BM_ARPC_NPEERS; h++ ) {
+		if ( h != me && h != net && h != bcst )
+			peers[n++] = htonl( h );
+	}
+
+	/* shuffle */
+	for ( i = n - 1; i > 0; i-- ) {
+		j        = rand() % (i + 1);
+		tmp      = peers[i];
+		peers[i] = peers[j];
+		peers[j] = tmp;
+	}
+
+	for ( i=0; i<n; i++ ) {
+		mac[4] = i >> 8;
+		mac[5] = i;
+		if ( arpPutEntry(lanIpIf, peers[i], mac, 0) )
+			putfail++;
+	}
+
+	for ( i=0; i<n; i++ ) {
+		if ( arpLookup(lanIpIf, peers[i], mac, 1) )
+			miss++;
+	}
+
+	if ( ! (st1 = lanIpBscGetStats()) )
+		goto egress;
+
+	fprintf(stderr,"  %6u slots: %4i peers, %4i put failures, %6"PRIu32" evicted, %6"PRIu32" no space, %4i misses (%.1f%%)\n",
+		sz, n, putfail,
+		st1->if_stats->arp_evicted - ifs->arp_evicted,
+		st1->if_stats->arp_nospc   - ifs->arp_nospc,
+		miss, 100.0*(double)miss/(double)n);
+
+	rval = 0;
+
+egress:
+	free(peers);
+	lanIpBscFreeStats(st0);
+	lanIpBscFreeStats(st1);
+	return rval;
+}
+
+int
+lanIpBmArpCache(char *ip, char *nmsk, uint8_t *enaddr, unsigned bigsz)
+{
+LanIpBscConfigRec ocfg, cfg;
+unsigned          sz[2];
+int               i, rval = -1;
+
+	if ( !ip || !nmsk ) {
+		fprintf(stderr,"Usage: lanIpBmArpCache(char *ip, char *netmask, enaddr, unsigned bigsz)\n");
+		return -1;
+	}
+
+	if ( lanIpDrv ) {
+		fprintf(stderr,"Stack must be down; use 'lanIpTakedown()'\n");
+		return -1;
+	}
+
+	lanIpBscConfig(0, &ocfg);
+
+	sz[0] = ocfg.arp_cache_size;
+	sz[1] = bigsz ? bigsz : 4*BM_ARPC_NPEERS;
+
+	fprintf(stderr,"lanIpBmArpCache: loading a /20\n");
+
+	for ( i=0; i<2; i++ ) {
+		rval               = -1;
+		cfg.mask           = LANIPCFG_ARPCSZ;
+		cfg.arp_cache_size = sz[i];
+		if ( lanIpBscConfig(&cfg, 0) ) {
+			fprintf(stderr,"lanIpBmArpCache: unable to set ARP cache size %u\n", sz[i]);
+			goto egress;
+		}
+		if ( lanIpSetup(ip, nmsk, 0, enaddr) )
+			goto egress;
+
+		rval = bmArpCacheRun(sz[i]);
+
+		if ( lanIpTakedown() || rval )
+			goto egress;
+	}
+
+egress:
+	cfg.mask           = LANIPCFG_ARPCSZ;
+	cfg.arp_cache_size = ocfg.arp_cache_size;
+	lanIpBscConfig(&cfg, 0);
+	return rval;
+}
+
+/* TX contention benchmark.
+ *
+ * For n = 1..'maxtasks' (max. BM_TX_MAXTASKS), 'n' tasks send PAYLDLEN byte
+ * datagrams to 'dipaddr'/'dport' as fast as they can for 'secs' seconds,
+ * each one on its own (connected) socket. All tasks run at the caller's
+ * priority with time-slicing.
+ *
+ * Prints, for every 'n', the aggregate rate, the average time spent in
+ * udpSockSend() (hwtimer ticks) and the number of failed sends.
+ *
+ * NOTES: 'dipaddr' is in network byte order; the peer must be reachable
+ *        (ARP). Nobody needs to listen.
+ *
+ * RETURNS: 0 on success, -1 on error.
+ */
+#define BM_TX_MAXTASKS 8
+
+typedef struct BmTxArgRec_ {
+	int                sd;
+	volatile uint32_t  nsent;
+	volatile uint32_t  nfail;
+	volatile uint32_t  ticks;   /* hwtimer ticks spent sending */
+	rtems_id           done;    /* released when task exits    */
+} BmTxArgRec, *BmTxArg;
+
+static volatile int bmTxRun;
+
+static rtems_task
+bmTxTask(rtems_task_argument arg)
+{
+BmTxArg  a = (BmTxArg)arg;
+uint8_t  pld[PAYLDLEN];
+uint32_t then;
+
+	memset( pld, 0, sizeof(pld) );
+
+	while ( bmTxRun ) {
+		then = Read_hwtimer();
+		if ( udpSockSend(a->sd, pld, sizeof(pld)) <= 0 )
+			a->nfail++;
+		else
+			a->nsent++;
+		a->ticks += Read_hwtimer() - then;
+	}
+	rtems_semaphore_release(a->done);
+	rtems_task_delete(RTEMS_SELF);
+}
+
+int
+lanIpBmSenders(uint32_t dipaddr, uint16_t dport, int maxtasks, int secs)
+{
+BmTxArgRec          args[BM_TX_MAXTASKS];
+uint8_t             mac[6];
+rtems_id            done = 0;
+rtems_task_priority pri;
+rtems_interval      rate;
+rtems_status_code   sc;
+uint32_t            nsent, nfail, ticks;
+int                 i, n, st, started, rval = -1;
+
+	if ( maxtasks < 1 || maxtasks > BM_TX_MAXTASKS || secs < 1 ) {
+		fprintf(stderr,"Usage: lanIpBmSenders(uint32_t dipaddr, uint16_t dport, int maxtasks [1..%i], int secs)\n", BM_TX_MAXTASKS);
+		return -1;
+	}
+
+	if ( ! lanIpIf ) {
+		fprintf(stderr,"Interface not set up; use 'lanIpSetup()'\n");
+		return -1;
+	}
+
+	if ( (st = arpLookup(lanIpIf, dipaddr, mac, 0)) ) {
+		fprintf(stderr,"lanIpBmSenders: peer not reachable: %s\n", strerror(-st));
+		return -1;
+	}
+
+	for ( i=0; i<maxtasks; i++ )
+		args[i].sd = -1;
+
+	for ( i=0; i<maxtasks; i++ ) {
+		if ( (args[i].sd = udpSockCreate(0)) < 0 ) {
+			fprintf(stderr,"lanIpBmSenders: unable to create socket: %s\n", strerror(-args[i].sd));
+			goto egress;
+		}
+		if ( (st = udpSockConnect(args[i].sd, dipaddr, dport, 0)) ) {
+			fprintf(stderr,"lanIpBmSenders: unable to connect socket: %s\n", strerror(-st));
+			goto egress;
+		}
+	}
+
+	sc = rtems_semaphore_create(
+			rtems_build_name('t','t','d','n'),
+			0,
+			RTEMS_COUNTING_SEMAPHORE | RTEMS_FIFO,
+			0,
+			&done);
+	if ( RTEMS_SUCCESSFUL != sc ) {
+		rtems_error(sc, "lanIpBmSenders: unable to create semaphore");
+		goto egress;
+	}
+
+	rtems_task_set_priority(RTEMS_SELF, RTEMS_CURRENT_PRIORITY, &pri);
+	rtems_clock_get(RTEMS_CLOCK_GET_TICKS_PER_SECOND, &rate);
+
+	fprintf(stderr,"lanIpBmSenders: %i byte payload, %is per run\n", PAYLDLEN, secs);
+	fprintf(stderr,"  tasks     pkts/s   ticks/send     failed\n");
+
+	for ( n=1; n<=maxtasks; n++ ) {
+		bmTxRun = 1;
+		for ( i=0, started=0; i<n; i++ ) {
+			args[i].nsent = args[i].nfail = args[i].ticks = 0;
+			args[i].done  = done;
+			if ( RTEMS_SUCCESSFUL != (sc = tstTaskStart('t', i, pri, bmTxTask, &args[i])) ) {
+				rtems_error(sc, "lanIpBmSenders: unable to create/start task #%i", i);
+				break;
+			}
+			started++;
+		}
+
+		if ( started == n )
+			rtems_task_wake_after( secs * rate );
+
+		bmTxRun = 0;
+
+		for ( i=0; i<started; i++ )
+			rtems_semaphore_obtain(done, RTEMS_WAIT, RTEMS_NO_TIMEOUT);
+
+		if ( started < n )
+			goto egress;
+
+		for ( i=0, nsent=nfail=ticks=0; i<n; i++ ) {
+			nsent += args[i].nsent;
+			nfail += args[i].nfail;
+			ticks += args[i].ticks;
+		}
+
+		fprintf(stderr,"  %5i %10"PRIu32" %12.2f %10"PRIu32"\n",
+			n, nsent/secs,
+			nsent + nfail ? (double)ticks/(double)(nsent + nfail) : 0.0,
+			nfail);
+	}
+
+	rval = 0;
+
+egress:
+	if ( done )
+		rtems_semaphore_delete(done);
+	for ( i=0; i<maxtasks; i++ ) {
+		if ( args[i].sd >= 0 )
+			udpSockDestroy(args[i].sd);
+	}
+	return rval;
+}
 
 int
 _cexpModuleFinalize(void* unused)
@@ -74,6 +74,34 @@ typedef struct IgmpV2HeaderRec_ {
 	uint32_t    gaddr;
 } __attribute__((may_alias)) IgmpV2HeaderRec;
 
+/* IGMPv3 (RFC 3376) query; starts with the IGMPv2 header                     */
+typedef struct IgmpV3QueryHeaderRec_ {
+	uint8_t     type;
+	uint8_t     max_rcode;
+	uint16_t    csum;
+	uint32_t    gaddr;
+	uint8_t     s_qrv;
+	uint8_t     qqic;
+	uint16_t    nsrcs;
+	uint32_t    srcs[];
+} __attribute__((may_alias)) IgmpV3QueryHeaderRec;
+
+typedef struct IgmpV3ReportHeaderRec_ {
+	uint8_t     type;
+	uint8_t     rsvd1;
+	uint16_t    csum;
+	uint16_t    rsvd2;
+	uint16_t    nrecs;
+} __attribute__((may_alias)) IgmpV3ReportHeaderRec;
+
+typedef struct IgmpV3GroupRecRec_ {
+	uint8_t     rtype;
+	uint8_t     auxlen;
+	uint16_t    nsrcs;
+	uint32_t    gaddr;
+	uint32_t    srcs[];
+} __attribute__((may_alias)) IgmpV3GroupRecRec;
+
 /*
  * Max. packet size incl. header, FCS-space and 2-byte padding (which is
  * never transmitted on the wire).
@@ -117,6 +145,14 @@ typedef struct LanIgmpV2PktRec_ {
 	}               igmp_u;
 } LanIgmpV2PktRec, *LanIgmpV2Pkt;
 
+/* IGMPv3 report with a single group record (we always set router-alert)     */
+typedef struct LanIgmpV3RepPktRec_ {
+	LanIpPartRec          ip_part;
+	uint32_t              ra_opt;
+	IgmpV3ReportHeaderRec igmp;
+	IgmpV3GroupRecRec     rec;
+} LanIgmpV3RepPktRec, *LanIgmpV3RepPkt;
+
 typedef struct LanIcmpPktRec_ {
 	LanIpPartRec    ip_part;
 	IcmpHeaderRec	icmp;
@@ -137,6 +173,7 @@ typedef union LanIpPacketHeaderRec_ {
 	LanIcmpPktRec      icmp_S;
 	LanUdpPktRec       udp_S;
 	LanIgmpV2PktRec    igmpv2_S;
+	LanIgmpV3RepPktRec igmpv3rep_S;
 } LanIpPacketHeaderRec, *LanIpPacketHeader;
 
 typedef union LanIpPacketRec_ {
@@ -156,6 +193,7 @@ typedef union LanIpPacketRec_ {
 #define lpkt_ip_hdrs(p)			(p)->p_u.ip_S.ip_part
 #define lpkt_udp_hdrs(p)		(p)->p_u.udp_S
 #define lpkt_igmpv2hdr(p)		(p)->p_u.igmpv2_S
+#define lpkt_igmpv3rep(p)		(p)->p_u.igmpv3rep_S
 
 #define lpkt_eth_pld(p,type)	(((union { char c[sizeof(type)]; type x; } __attribute__((may_alias)) *)(p)->p_u.eth_S.pld)->x)
 #define lpkt_icmp_pld(p,type)	(((union { char c[sizeof(type)]; type x; } __attribute__((may_alias)) *)(p)->p_u.icmp_S.pld)->x)